@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <cstring>
+#include <dlfcn.h>
+#include <string>
+#include "aot.h"
+
+Aot::Aot(Chip8& chip): chip(chip), handle(nullptr), module(nullptr), version(chip.codeVersion), compiledCycles(0)
+{
+}
+
+Aot::~Aot()
+{
+    if (handle)
+    {
+        dlclose(handle);
+    }
+}
+
+bool Aot::load(const char* path)
+{
+    // a bare file name would be looked up on the library path rather than in the current directory
+    std::string file = std::strchr(path, '/') ? path : std::string("./") + path;
+    void* opened = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!opened)
+    {
+        printf("Could not load %s: %s\n", path, dlerror());
+        return false;
+    }
+
+    const AotModule* found = static_cast<const AotModule*>(dlsym(opened, AOT_MODULE_SYMBOL));
+    const char* problem = nullptr;
+    if (!found)
+    {
+        problem = "it was not built by chip8-aot";
+    }
+    else if (found->abiVersion != AOT_ABI_VERSION || found->chipSize != sizeof(Chip8))
+    {
+        problem = "it was built by a different version of chip8-aot or with different build flags";
+    }
+    else if (found->quirks != chip.quirks)
+    {
+        problem = "it was compiled for a different quirk profile";
+    }
+    else if (found->romSize > MEM_SIZE - PROGRAM_ADDRESS || std::memcmp(chip.mem + PROGRAM_ADDRESS, found->rom, found->romSize))
+    {
+        problem = "it was compiled from a different ROM";
+    }
+    if (problem)
+    {
+        printf("Could not use %s, %s\n", path, problem);
+        dlclose(opened);
+        return false;
+    }
+
+    handle = opened;
+    module = found;
+    blockAt.assign(MEM_SIZE, -1);
+    for (uint32_t i = 0; i < module->blockCount; ++i)
+    {
+        blockAt[module->blocks[i].addr & ADDRESS_MASK] = i;
+    }
+    state.assign(module->blockCount, BLOCK_UNCHECKED);
+    version = chip.codeVersion;
+    return true;
+}
+
+bool Aot::ok() const
+{
+    return module != nullptr;
+}
+
+// a block may only run while memory still holds the bytes it was compiled from
+bool Aot::check(int32_t index)
+{
+    const AotBlock& block = module->blocks[index];
+    uint32_t offset = block.addr - PROGRAM_ADDRESS;
+    bool same = offset + block.checkBytes <= module->romSize &&
+        std::memcmp(chip.mem + block.addr, module->rom + offset, block.checkBytes) == 0;
+
+    // checked addresses go through the decode table so writes to them bump codeVersion and get them checked again
+    for (uint32_t pc = block.addr; pc < (uint32_t)block.addr + block.checkBytes; pc += 2)
+    {
+        if (chip.decoded[pc & ADDRESS_MASK].op == OP_DECODE)
+        {
+            chip.decode(pc);
+        }
+    }
+
+    state[index] = same ? BLOCK_VALID : BLOCK_STALE;
+    return same;
+}
+
+// Runs compiled blocks where possible and single interpreter steps for everything else.
+void Aot::runCycles(int cycles, uint16_t keypad, uint16_t& keyUp)
+{
+    if (!ok())
+    {
+        chip.runCycles(cycles, keypad, keyUp);
+        return;
+    }
+
+    while (cycles > 0 && !chip.halt)
+    {
+        if (chip.codeVersion != version)
+        {
+            std::fill(state.begin(), state.end(), BLOCK_UNCHECKED);
+            version = chip.codeVersion;
+        }
+
+        int32_t index = blockAt[chip.PC & ADDRESS_MASK];
+        if (index >= 0 && module->blocks[index].length <= cycles &&
+            (state[index] == BLOCK_VALID || (state[index] == BLOCK_UNCHECKED && check(index))) &&
+            module->blocks[index].fn(chip, keypad))
+        {
+            int length = module->blocks[index].length;
+            chip.cycleCount += length;
+            compiledCycles += length;
+            cycles -= length;
+        }
+        else
+        {
+            // waits only fast-forward when the interpreter is handed the rest of the batch
+            const Instruction& ins = chip.decoded[chip.PC & ADDRESS_MASK];
+            bool waiting = ins.op == OP_LD_K || (ins.op == OP_JP_LOOP && chip.idleLoopLength(chip.PC, ins.nnn, keypad));
+            int step = waiting ? cycles : 1;
+            chip.runCycles(step, keypad, keyUp);
+            cycles -= step;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef CHIP8_AOT
+#define CHIP8_AOT
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "chip8.h"
+
+constexpr uint32_t AOT_ABI_VERSION = 2; // bump whenever AotBlock, AotModule or what a block may assume changes
+constexpr int AOT_MAX_BLOCK = 64; // most instructions compiled into one block
+const char* const AOT_MODULE_SYMBOL = "chip8_aot_module";
+
+// A compiled basic block. It runs length instructions starting at addr and
+// leaves PC at the next one to execute, or returns false without touching
+// anything if its entry checks fail (a call with the stack full, a return with
+// it empty) so the interpreter can take the instruction instead.
+typedef bool (*AotBlockFn)(Chip8& chip, uint16_t keypad);
+
+struct AotBlock {
+    uint16_t addr;
+    uint16_t length;     // instructions
+    uint16_t checkBytes; // bytes from addr the code was compiled from, the block only runs while memory still holds them
+    AotBlockFn fn;
+};
+
+// What chip8-aot emits into every translation unit, exported as AOT_MODULE_SYMBOL.
+struct AotModule {
+    uint32_t abiVersion;
+    uint32_t chipSize; // sizeof(Chip8) the module was built against, catches a mismatched TRACE or PROFILE build
+    QuirkProfile quirks;
+    uint32_t romSize;
+    const uint8_t* rom; // the image the blocks were compiled from, loaded at PROGRAM_ADDRESS
+    uint32_t blockCount;
+    const AotBlock* blocks;
+};
+
+// Runs a ROM through native code compiled ahead of time by chip8-aot into a
+// shared object. Discovery can never see every path (Bnnn, returns, code the
+// program writes itself), so whatever the module has no block for, or whose
+// bytes no longer match what it was compiled from, is interpreted.
+struct Aot {
+    // the ROM must already be in chip's memory
+    Aot(Chip8& chip);
+    ~Aot();
+
+    Chip8& chip;
+    void* handle; // dlopen handle, nullptr until load succeeds
+    const AotModule* module;
+
+    enum BlockState : uint8_t
+    {
+        BLOCK_UNCHECKED, // memory not compared with the image since codeVersion last changed
+        BLOCK_VALID,
+        BLOCK_STALE      // memory differs from the image, interpreted until codeVersion changes
+    };
+
+    std::vector<int32_t> blockAt; // index into module->blocks for each address of mem, -1 if none
+    std::vector<uint8_t> state;   // BlockState of each block
+    uint32_t version;             // chip.codeVersion the states were checked against
+    uint64_t compiledCycles;      // instructions run by compiled blocks
+
+    bool load(const char* path);
+    bool ok() const;
+    void runCycles(int cycles, uint16_t keypad, uint16_t& keyUp);
+
+    bool check(int32_t index);
+};
+
+#endif
@@ -0,0 +1,453 @@
+#include <cstdarg>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include "aot.h"
+
+using std::printf; using std::exit;
+
+void usage()
+{
+    printf("usage: chip8-aot <rom> <out.cpp> [-q modern|vip|chip48|schip|xochip]\n");
+    printf("       build the output with: g++ -I. -O2 -shared -fPIC out.cpp -o rom.so\n");
+    exit(1);
+}
+
+namespace
+{
+    enum Kind : uint8_t
+    {
+        KIND_INTERPRETED, // left to the interpreter, ends the block before it
+        KIND_STRAIGHT,    // compiled, falls through to the next instruction
+        KIND_TERMINATOR,  // compiled, sets PC itself and ends the block
+        KIND_SKIP         // a terminator whose target also depends on the instruction after it
+    };
+
+    struct Generator {
+        std::unique_ptr<Chip8> chip;
+        Quirks quirks;
+        uint32_t romEnd;            // first address past the image
+        std::vector<bool> visited;  // addresses already taken as block leaders
+        std::vector<uint16_t> work; // leaders still to compile
+        std::string code;           // block functions
+        std::string table;          // AotBlock entries
+        int blocks;
+        int instructions;
+
+        const Instruction& at(uint16_t pc)
+        {
+            if (chip->decoded[pc].op == OP_DECODE)
+            {
+                chip->decode(pc);
+            }
+            return chip->decoded[pc];
+        }
+
+        bool inImage(uint32_t addr, uint32_t bytes) const
+        {
+            return addr >= PROGRAM_ADDRESS && addr + bytes <= romEnd;
+        }
+
+        void lead(uint32_t addr)
+        {
+            // targets outside the image are data or code the program writes at run time, both interpreted
+            if (inImage(addr, 2) && !visited[addr])
+            {
+                visited[addr] = true;
+                work.push_back(addr);
+            }
+        }
+
+        // where a skip lands when it is taken, the next instruction being two words long if it is F000 nnnn
+        uint16_t skipTarget(uint16_t pc) const
+        {
+            bool longLoad = chip->mem[pc + 2] == 0xF0 && chip->mem[pc + 3] == 0x00;
+            return pc + (longLoad ? 6 : 4);
+        }
+
+        Kind kind(uint16_t pc);
+        void follow(uint16_t pc);
+        void emit(std::string& body, std::string& entry, uint16_t pc);
+        void compile(uint16_t addr);
+        void run();
+    };
+
+    std::string format(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+    std::string format(const char* fmt, ...)
+    {
+        char line[256];
+        va_list args;
+        va_start(args, fmt);
+        std::vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        return line;
+    }
+}
+
+Kind Generator::kind(uint16_t pc)
+{
+    const Instruction& ins = at(pc);
+    switch (ins.op)
+    {
+        case (OP_SYS):
+        case (OP_LD_BYTE):
+        case (OP_ADD_BYTE):
+        case (OP_LD_REG):
+        case (OP_OR):
+        case (OP_AND):
+        case (OP_XOR):
+        case (OP_ADD_REG):
+        case (OP_SUB):
+        case (OP_SHR):
+        case (OP_SUBN):
+        case (OP_SHL):
+        case (OP_LD_I):
+        case (OP_LD_VX_DT):
+        case (OP_LD_DT):
+        case (OP_ADD_I):
+        case (OP_LD_F):
+        case (OP_LD_HF):
+        case (OP_LD_READ):
+            return KIND_STRAIGHT;
+        case (OP_JP):
+        case (OP_CALL):
+        case (OP_RET):
+        case (OP_JP_V0):
+            return KIND_TERMINATOR;
+        case (OP_SE_BYTE):
+        case (OP_SNE_BYTE):
+        case (OP_SE_REG):
+        case (OP_SNE_REG):
+        case (OP_SKP):
+        case (OP_SKNP):
+            // the skip distance depends on the next instruction, which has to be in the image to be checked
+            return inImage(pc, 4) ? KIND_SKIP : KIND_INTERPRETED;
+        default:
+            // OP_JP_LOOP included: the interpreter fast-forwards idle waits, compiled code would spin through them
+            return KIND_INTERPRETED;
+    }
+}
+
+// queues every address control can reach from the instruction at pc
+void Generator::follow(uint16_t pc)
+{
+    const Instruction& ins = at(pc);
+    switch (ins.op)
+    {
+        case (OP_JP):
+        case (OP_JP_LOOP):
+            lead(ins.nnn);
+            break;
+        case (OP_CALL):
+            lead(ins.nnn);
+            lead(pc + 2);
+            break;
+        case (OP_SE_BYTE):
+        case (OP_SNE_BYTE):
+        case (OP_SE_REG):
+        case (OP_SNE_REG):
+        case (OP_SKP):
+        case (OP_SKNP):
+            lead(pc + 2);
+            lead(inImage(pc, 4) ? skipTarget(pc) : pc + 4);
+            break;
+        case (OP_LD_LONG):
+            lead(pc + 4);
+            break;
+        case (OP_RET):
+        case (OP_JP_V0):
+        case (OP_EXIT):
+        case (OP_INVALID):
+            // returns land after calls, which are leaders already; Bnnn targets are only known at run time
+            break;
+        default:
+            lead(pc + 2);
+            break;
+    }
+}
+
+// appends the C++ for one instruction to body, and to entry any check that must pass before the block changes anything.
+// Every statement reads and writes V in the same order as the matching Chip8 member so x or y being F behaves identically.
+void Generator::emit(std::string& body, std::string& entry, uint16_t pc)
+{
+    const Instruction& ins = at(pc);
+    unsigned x = ins.x, y = ins.y;
+
+    body += format("    // %04X  %02X%02X\n", pc, chip->mem[pc], chip->mem[pc + 1]);
+    switch (ins.op)
+    {
+        case (OP_SYS):
+            break;
+        case (OP_LD_BYTE):
+            body += format("    c.V[0x%X] = 0x%02X;\n", x, ins.nn);
+            break;
+        case (OP_ADD_BYTE):
+            body += format("    c.V[0x%X] += 0x%02X;\n", x, ins.nn);
+            break;
+        case (OP_LD_REG):
+            body += format("    c.V[0x%X] = c.V[0x%X];\n", x, y);
+            break;
+        case (OP_OR):
+        case (OP_AND):
+        case (OP_XOR):
+            body += format("    c.V[0x%X] %s= c.V[0x%X];\n", x, ins.op == OP_OR ? "|" : ins.op == OP_AND ? "&" : "^", y);
+            if (quirks.logicResetsVF)
+            {
+                body += "    c.V[0xF] = 0;\n";
+            }
+            break;
+        case (OP_ADD_REG):
+            body += format("    {\n        uint8_t sum = c.V[0x%X] + c.V[0x%X];\n", x, y);
+            body += format("        c.V[0xF] = sum < (c.V[0x%X] | c.V[0x%X]);\n", x, y);
+            body += format("        c.V[0x%X] = sum;\n    }\n", x);
+            break;
+        case (OP_SUB):
+            body += format("    c.V[0xF] = c.V[0x%X] > c.V[0x%X];\n", x, y);
+            body += format("    c.V[0x%X] = c.V[0x%X] - c.V[0x%X];\n", x, x, y);
+            break;
+        case (OP_SUBN):
+            body += format("    c.V[0xF] = c.V[0x%X] > c.V[0x%X];\n", y, x);
+            body += format("    c.V[0x%X] = c.V[0x%X] - c.V[0x%X];\n", x, y, x);
+            break;
+        case (OP_SHR):
+        case (OP_SHL):
+            if (quirks.shiftUsesVy)
+            {
+                body += format("    c.V[0x%X] = c.V[0x%X];\n", x, y);
+            }
+            if (ins.op == OP_SHR)
+            {
+                body += format("    c.V[0xF] = c.V[0x%X] & 1;\n    c.V[0x%X] = c.V[0x%X] >> 1;\n", x, x, x);
+            }
+            else
+            {
+                body += format("    c.V[0xF] = c.V[0x%X] >> 7;\n    c.V[0x%X] = c.V[0x%X] << 1;\n", x, x, x);
+            }
+            break;
+        case (OP_LD_I):
+            body += format("    c.I = 0x%03X;\n", ins.nnn);
+            break;
+        case (OP_LD_VX_DT):
+            body += format("    c.V[0x%X] = c.DT;\n", x);
+            break;
+        case (OP_LD_DT):
+            body += format("    c.DT = c.V[0x%X];\n", x);
+            break;
+        case (OP_ADD_I):
+            body += format("    c.I = c.I + c.V[0x%X];\n", x);
+            break;
+        case (OP_LD_F):
+            body += format("    c.I = c.V[0x%X] * 5;\n", x);
+            break;
+        case (OP_LD_HF):
+            body += format("    c.I = 0x%X + (c.V[0x%X] & 0xF) * 10;\n", BIG_FONT_ADDRESS, x);
+            break;
+        case (OP_LD_READ):
+            for (unsigned i = 0; i <= x; ++i)
+            {
+                body += format("    c.V[0x%X] = c.mem[(c.I + %u) & 0x%X];\n", i, i, ADDRESS_MASK);
+            }
+            if (quirks.memory == MEMORY_ADDS_X)
+            {
+                body += format("    c.I += %u;\n", x);
+            }
+            else if (quirks.memory == MEMORY_ADDS_X_PLUS_1)
+            {
+                body += format("    c.I += %u;\n", x + 1);
+            }
+            break;
+        case (OP_JP):
+            body += format("    c.PC = 0x%04X;\n", ins.nnn);
+            break;
+        case (OP_JP_V0):
+            body += format("    c.PC = (uint16_t)(c.V[0x%X] + 0x%03X);\n", quirks.jumpUsesVx ? x : 0, ins.nnn);
+            break;
+        case (OP_CALL):
+            // a full stack is left to the interpreter, which halts the program there
+            entry += format("    if (c.SP >= %d)\n    {\n        return false;\n    }\n", STACK_DEPTH);
+            body += format("    ++c.SP;\n    c.stack[c.SP] = 0x%04X;\n    c.PC = 0x%04X;\n", pc, ins.nnn);
+            break;
+        case (OP_RET):
+            entry += format("    if (c.SP == 0 || c.SP > %d)\n    {\n        return false;\n    }\n", STACK_DEPTH);
+            body += "    c.PC = c.stack[c.SP] + 2;\n    --c.SP;\n";
+            break;
+        case (OP_SE_BYTE):
+            body += format("    c.PC = c.V[0x%X] == 0x%02X", x, ins.nn);
+            break;
+        case (OP_SNE_BYTE):
+            body += format("    c.PC = c.V[0x%X] != 0x%02X", x, ins.nn);
+            break;
+        case (OP_SE_REG):
+            body += format("    c.PC = c.V[0x%X] == c.V[0x%X]", x, y);
+            break;
+        case (OP_SNE_REG):
+            body += format("    c.PC = c.V[0x%X] != c.V[0x%X]", x, y);
+            break;
+        case (OP_SKP):
+            body += format("    c.PC = (keypad & (1 << (c.V[0x%X] & 0xF)))", x);
+            break;
+        case (OP_SKNP):
+            body += format("    c.PC = !(keypad & (1 << (c.V[0x%X] & 0xF)))", x);
+            break;
+    }
+
+    switch (ins.op)
+    {
+        case (OP_SE_BYTE):
+        case (OP_SNE_BYTE):
+        case (OP_SE_REG):
+        case (OP_SNE_REG):
+        case (OP_SKP):
+        case (OP_SKNP):
+            body += format(" ? 0x%04X : 0x%04X;\n", skipTarget(pc), (uint16_t)(pc + 2));
+            break;
+    }
+}
+
+// compiles the block starting at addr, if its first instruction can be, and queues everything it leads to
+void Generator::compile(uint16_t addr)
+{
+    std::string body, entry;
+    uint16_t pc = addr;
+    int length = 0;
+    uint16_t checkBytes = 0;
+    bool ended = false;
+
+    while (length < AOT_MAX_BLOCK && inImage(pc, 2))
+    {
+        Kind k = kind(pc);
+        if (k == KIND_INTERPRETED)
+        {
+            break;
+        }
+        emit(body, entry, pc);
+        ++length;
+        if (k != KIND_STRAIGHT)
+        {
+            checkBytes = pc + (k == KIND_SKIP ? 4 : 2) - addr;
+            follow(pc);
+            ended = true;
+            break;
+        }
+        pc += 2;
+        checkBytes = pc - addr;
+    }
+
+    if (!ended)
+    {
+        // the interpreter takes over at pc, or the next block does if the length limit stopped this one
+        if (length == 0)
+        {
+            follow(pc);
+            return;
+        }
+        lead(pc);
+        body += format("    c.PC = 0x%04X;\n", pc);
+    }
+
+    code += format("// %04X, %d instructions\nbool block_%04X(Chip8& c, uint16_t keypad)\n{\n", addr, length, addr);
+    code += entry + body + "    return true;\n}\n\n";
+    table += format("    { 0x%04X, %d, %u, block_%04X },\n", addr, length, checkBytes, addr);
+    ++blocks;
+    instructions += length;
+}
+
+void Generator::run()
+{
+    visited.assign(MEM_SIZE, false);
+    lead(PROGRAM_ADDRESS);
+    while (!work.empty())
+    {
+        uint16_t addr = work.back();
+        work.pop_back();
+        compile(addr);
+    }
+}
+
+// Discovers the code reachable from PROGRAM_ADDRESS in a ROM and writes it out
+// as a C++ translation unit with one function per basic block, to be built
+// into a shared object that Aot loads.
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        usage();
+    }
+
+    QuirkProfile profile = QUIRKS_MODERN;
+    for (auto i = 3; i < argc; ++i)
+    {
+        if (i + 1 < argc && !std::strcmp(argv[i], "-q") && parseQuirkProfile(argv[i + 1], profile))
+        {
+            ++i;
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    std::ifstream romFile(argv[1], std::ios_base::binary);
+    if (!romFile)
+    {
+        printf("File not found\n");
+        exit(1);
+    }
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(romFile)), std::istreambuf_iterator<char>());
+    // nothing to compile, and the ROM table below would be an empty array, which is not valid C++
+    if (rom.empty())
+    {
+        printf("%s is empty\n", argv[1]);
+        exit(1);
+    }
+
+    Generator gen;
+    gen.chip.reset(new Chip8());
+    if (!gen.chip->loadBytes(rom.data(), rom.size(), profile))
+    {
+        exit(1);
+    }
+    gen.quirks = QUIRK_PROFILES[profile];
+    gen.romEnd = PROGRAM_ADDRESS + rom.size();
+    gen.blocks = 0;
+    gen.instructions = 0;
+    gen.run();
+
+    FILE* out = std::fopen(argv[2], "w");
+    if (!out)
+    {
+        printf("Could not open %s\n", argv[2]);
+        exit(1);
+    }
+
+    const char* name = std::strrchr(argv[1], '/') ? std::strrchr(argv[1], '/') + 1 : argv[1];
+    std::fprintf(out, "// generated by chip8-aot from %s for the %s quirks, do not edit\n", name, QUIRK_PROFILE_NAMES[profile]);
+    std::fprintf(out, "#include \"aot.h\"\n\nnamespace\n{\n\n%s", gen.code.c_str());
+
+    std::fprintf(out, "const uint8_t ROM[] =\n{");
+    for (size_t i = 0; i < rom.size(); ++i)
+    {
+        std::fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", rom[i]);
+    }
+    std::fprintf(out, "\n};\n\n");
+
+    // a ROM with nothing to compile still gets a table, an empty array is not valid C++
+    std::fprintf(out, "const AotBlock BLOCKS[] =\n{\n%s    { 0, 0, 0, nullptr }\n};\n\n}\n\n", gen.table.c_str());
+    std::fprintf(out, "extern \"C\" const AotModule chip8_aot_module =\n{\n");
+    std::fprintf(out, "    AOT_ABI_VERSION, sizeof(Chip8), (QuirkProfile)%d, sizeof(ROM), ROM, %d, BLOCKS\n};\n", profile, gen.blocks);
+
+    bool failed = std::ferror(out);
+    failed |= std::fclose(out) != 0;
+    if (failed)
+    {
+        printf("Could not write %s\n", argv[2]);
+        exit(1);
+    }
+    printf("%d blocks, %d instructions compiled\n", gen.blocks, gen.instructions);
+}
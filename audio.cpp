@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include "audio.h"
+
+namespace
+{
+    // XO-CHIP plays the pattern at 4000 * 2 ^ ((pitch - 64) / 48) bits per second
+    double bitsPerSecond(uint8_t pitch)
+    {
+        return 4000.0 * std::pow(2.0, (pitch - 64) / 48.0);
+    }
+}
+
+AudioStream::AudioStream(): emulatedCycle(0), dropped(0), cyclesPerSample(0), frameCycles(0), maxLag(0), playCycle(0), phase(0), bitStep(0), sampleRate(AUDIO_SAMPLE_RATE), current{}
+{
+    configure(AUDIO_SAMPLE_RATE, DEFAULT_CYCLES_PER_FRAME * TIMER_FREQ);
+}
+
+void AudioStream::configure(int rate, double cyclesPerSecond)
+{
+    sampleRate = rate;
+    cyclesPerSample = cyclesPerSecond / rate;
+    frameCycles = cyclesPerSecond / TIMER_FREQ;
+    // with the device buffer this keeps a beep under 20 ms behind the frame that started it
+    maxLag = frameCycles / 2;
+    bitStep = bitsPerSecond(current.pitch) / sampleRate;
+}
+
+void AudioStream::push(const Chip8& chip, uint64_t cycle)
+{
+    send(chip, cycle, chip.ST > 0);
+}
+
+void AudioStream::mute(const Chip8& chip, uint64_t cycle)
+{
+    send(chip, cycle, false);
+}
+
+void AudioStream::send(const Chip8& chip, uint64_t cycle, bool on)
+{
+    SoundEvent event;
+    event.cycle = cycle;
+    event.on = on;
+    event.pitch = chip.pitch;
+    std::copy(chip.audioPattern, chip.audioPattern + AUDIO_PATTERN_SIZE, event.pattern);
+    // only a callback stuck for many frames lets the queue fill, and then the sound is lost anyway
+    if (!queue.push(event))
+    {
+        ++dropped;
+    }
+}
+
+void AudioStream::frameDone(uint64_t cycle)
+{
+    emulatedCycle.store(cycle, std::memory_order_release);
+}
+
+void AudioStream::render(int16_t* samples, int count)
+{
+    double target = emulatedCycle.load(std::memory_order_acquire);
+
+    // emulation runs a frame's instructions in one burst, so the frame being heard started a frame before target;
+    // after a stall, skip ahead rather than play the backlog late
+    if (playCycle < target - frameCycles - maxLag)
+    {
+        playCycle = target - frameCycles;
+    }
+
+    for (auto i = 0; i < count; ++i)
+    {
+        // a paused emulator holds the buzzer as it is
+        playCycle = std::min(playCycle + cyclesPerSample, target);
+
+        while (const SoundEvent* event = queue.front())
+        {
+            if (event->cycle > playCycle)
+            {
+                break;
+            }
+            current = *event;
+            bitStep = bitsPerSecond(current.pitch) / sampleRate;
+            queue.pop();
+        }
+
+        if (!current.on)
+        {
+            samples[i] = 0;
+            continue;
+        }
+        int bit = (int)phase;
+        samples[i] = (current.pattern[bit >> 3] & (0x80 >> (bit & 7))) ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+        phase += bitStep;
+        if (phase >= AUDIO_PATTERN_SIZE * 8)
+        {
+            phase -= AUDIO_PATTERN_SIZE * 8;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef CHIP8_AUDIO
+#define CHIP8_AUDIO
+
+#include <atomic>
+#include <cstdint>
+#include "chip8.h"
+#include "spsc.h"
+
+constexpr int AUDIO_SAMPLE_RATE = 48000;
+constexpr int AUDIO_BUFFER_SAMPLES = 256; // 5.3 ms per device buffer at 48 khz
+constexpr int AUDIO_QUEUE_SIZE = 256;     // sound events in flight, a few frames' worth even for busy programs
+constexpr int16_t AUDIO_AMPLITUDE = 4000;
+
+// the buzzer state from some instruction on, as the emulation thread saw it
+struct SoundEvent {
+    uint64_t cycle; // Chip8::cycleCount of the instruction that changed it
+    bool on;        // ST > 0
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+// Carries buzzer changes from the emulation thread to the audio callback and
+// turns them into samples. Chip8 pushes an event whenever the buzzer starts,
+// stops or changes its pattern or pitch; the frontend publishes how far
+// emulation has got after every frame. The callback plays events at the
+// cycle they happened, so a beep lasts exactly as many instructions as ST
+// kept it on, and never waits on the emulation thread.
+struct AudioStream {
+    AudioStream();
+
+    // set before the callback starts; cyclesPerSecond is the emulation speed
+    void configure(int sampleRate, double cyclesPerSecond);
+
+    // emulation thread
+    void push(const Chip8& chip, uint64_t cycle);
+    void mute(const Chip8& chip, uint64_t cycle); // silent from cycle on, until the next push
+    void frameDone(uint64_t cycle);
+    void send(const Chip8& chip, uint64_t cycle, bool on);
+
+    // audio callback
+    void render(int16_t* samples, int count);
+
+    SpscQueue<SoundEvent, AUDIO_QUEUE_SIZE> queue;
+    std::atomic<uint64_t> emulatedCycle; // the last cycle emulation has finished
+    uint64_t dropped; // events lost to a full queue, only touched by the emulation thread
+
+    // consumer state
+    double cyclesPerSample;
+    double frameCycles;
+    double maxLag;    // cycles playback may fall behind the start of the current frame before it skips ahead
+    double playCycle; // instruction being heard now
+    double phase;     // position in the 128 bit pattern
+    double bitStep;   // pattern bits per sample at the current pitch
+    int sampleRate;
+    SoundEvent current;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include "chip8.h"
+#include "romlibrary.h"
+#include "runner.h"
+
+using std::printf; using std::exit;
+
+void usage()
+{
+    printf("usage: chip8-batch <rom> [-n jobs] [-f frames] [-p cycles-per-frame] [-j threads] [-s first-seed] [-i keypad-script] [-q modern|vip|chip48|schip|xochip] [-l rom-library] [-a module | -w 8|16|32] [-c]\n");
+    printf("       -a runs every job on native code chip8-aot compiled for the ROM, make rom.so builds it\n");
+    printf("       -w runs that many jobs side by side in the lanes of one engine\n");
+    printf("       -c checks every job against the plain interpreter running it on its own\n");
+    printf("       with -l, <rom> is a file name or hash in the library and its index entry gives the defaults for -p and -q\n");
+    exit(1);
+}
+
+// keypad script: one hexadecimal keypad mask per line, one line per frame
+std::vector<uint16_t> readScript(const char* filename)
+{
+    std::vector<uint16_t> keypad;
+    FILE* file = std::fopen(filename, "r");
+    if (!file)
+    {
+        printf("File not found\n");
+        exit(1);
+    }
+    unsigned int mask;
+    while (std::fscanf(file, "%x", &mask) == 1)
+    {
+        keypad.push_back(mask);
+    }
+    std::fclose(file);
+    return keypad;
+}
+
+// Runs many independent instances of one ROM, each with its own seed, and
+// prints the cycle count and final state and screen hashes of every run.
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+
+    int jobCount = 64;
+    int frames = 600;
+    int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    int threads = std::max(1u, std::thread::hardware_concurrency()); // it may not know, and says 0
+    uint64_t firstSeed = DEFAULT_SEED;
+    const char* scriptFile = nullptr;
+    const char* libraryDir = nullptr;
+    const char* moduleFile = nullptr;
+    int lanes = 1;
+    bool check = false;
+    QuirkProfile quirks = QUIRKS_MODERN;
+    bool cyclesPerFrameSet = false;
+    bool quirksSet = false;
+
+    for (auto i = 2; i < argc; ++i)
+    {
+        if (!std::strcmp(argv[i], "-c"))
+        {
+            check = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+        }
+        if (!std::strcmp(argv[i], "-n"))
+        {
+            jobCount = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-f"))
+        {
+            frames = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-p"))
+        {
+            cyclesPerFrame = std::atoi(argv[++i]);
+            cyclesPerFrameSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-j"))
+        {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-s"))
+        {
+            firstSeed = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if (!std::strcmp(argv[i], "-i"))
+        {
+            scriptFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-q"))
+        {
+            if (!parseQuirkProfile(argv[++i], quirks))
+            {
+                usage();
+            }
+            quirksSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-l"))
+        {
+            libraryDir = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-a"))
+        {
+            moduleFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-w"))
+        {
+            lanes = std::atoi(argv[++i]);
+            if (lanes != 8 && lanes != 16 && lanes != 32)
+            {
+                usage();
+            }
+        }
+        else
+        {
+            usage();
+        }
+    }
+    if ((moduleFile && lanes > 1) || jobCount <= 0 || frames < 0 || cyclesPerFrame <= 0 || threads <= 0)
+    {
+        usage();
+    }
+
+    // every job loads straight from the one mapping or buffer
+    RomLibrary library;
+    std::vector<uint8_t> romBuffer;
+    const uint8_t* rom;
+    size_t romSize;
+    if (libraryDir)
+    {
+        if (!library.open(libraryDir))
+        {
+            exit(1);
+        }
+        const Rom* entry = library.find(argv[1]);
+        if (!entry)
+        {
+            printf("%s is not in the ROM library\n", argv[1]);
+            exit(1);
+        }
+        rom = entry->data;
+        romSize = entry->size;
+        cyclesPerFrame = cyclesPerFrameSet ? cyclesPerFrame : entry->settings.cyclesPerFrame();
+        quirks = quirksSet ? quirks : entry->settings.quirks;
+    }
+    else
+    {
+        std::ifstream romFile(argv[1], std::ios_base::binary);
+        if (!romFile)
+        {
+            printf("File not found\n");
+            exit(1);
+        }
+        romBuffer.assign(std::istreambuf_iterator<char>(romFile), std::istreambuf_iterator<char>());
+        rom = romBuffer.data();
+        romSize = romBuffer.size();
+    }
+
+    std::vector<uint16_t> script;
+    if (scriptFile)
+    {
+        script = readScript(scriptFile);
+    }
+
+    std::vector<Job> jobs(jobCount);
+    for (auto i = 0; i < jobCount; ++i)
+    {
+        jobs[i] = Job{ rom, romSize, scriptFile ? &script : nullptr, firstSeed + i, frames, cyclesPerFrame, quirks, moduleFile };
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<JobResult> results = runJobs(jobs, threads, lanes);
+    auto end = std::chrono::steady_clock::now();
+
+    uint64_t totalCycles = 0;
+    for (auto i = 0; i < jobCount; ++i)
+    {
+        const JobResult& result = results[i];
+        if (!result.loaded)
+        {
+            printf("job %d: ROM could not be loaded\n", i);
+            continue;
+        }
+        printf("job %d seed %llu cycles %llu state %016llx frame %016llx\n", i, (unsigned long long)jobs[i].seed,
+            (unsigned long long)result.cycles, (unsigned long long)result.stateHash,
+            (unsigned long long)(result.frameHashes.empty() ? 0 : result.frameHashes.back()));
+        totalCycles += result.cycles;
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("%d jobs on %d threads, %llu instructions in %.3f s (%.0f instructions/sec)\n", jobCount, threads,
+        (unsigned long long)totalCycles, seconds, totalCycles / seconds);
+
+    if (check)
+    {
+        // every frame has to match the same job run on its own by the interpreter
+        std::vector<Job> plain = jobs;
+        for (auto& job : plain)
+        {
+            job.module = nullptr;
+        }
+        std::vector<JobResult> alone = runJobs(plain, threads);
+        int mismatches = 0;
+        for (auto i = 0; i < jobCount; ++i)
+        {
+            const JobResult& a = results[i];
+            const JobResult& b = alone[i];
+            if (a.loaded != b.loaded || a.cycles != b.cycles || a.stateHash != b.stateHash || a.frameHashes != b.frameHashes)
+            {
+                printf("job %d differs from a run on its own (cycles %llu, alone %llu)\n", i, (unsigned long long)a.cycles, (unsigned long long)b.cycles);
+                ++mismatches;
+            }
+        }
+        if (mismatches)
+        {
+            exit(1);
+        }
+        printf("every job matches a run on its own\n");
+    }
+}
@@ -0,0 +1,234 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+#include "chip8.h"
+#include "jit.h"
+
+using std::printf; using std::exit;
+
+constexpr int REPETITIONS = 7;
+constexpr int DEFAULT_BENCH_CYCLES = 20000000;
+constexpr int BENCH_BATCH = DEFAULT_CYCLES_PER_FRAME * 100; // instructions per runCycles call, 100 timer ticks keep the per-call overhead out
+constexpr int CYCLES_PER_PRESENT = 1000; // the present rows draw one frame for every this many instructions of -c
+
+// Synthetic workloads, each an endless loop starting at PROGRAM_ADDRESS.
+// Keeping them here means every build measures exactly the same programs.
+
+// 8xy* arithmetic with no memory or control flow besides the loop jump
+const std::vector<uint8_t> aluRom
+{
+    0x60, 0x11, 0x61, 0x22, 0x62, 0x33,
+    0x80, 0x14, 0x81, 0x25, 0x82, 0x07, 0x83, 0x01, 0x84, 0x32, 0x85, 0x43,
+    0x86, 0x06, 0x87, 0x1E, 0x70, 0x03, 0x88, 0x40,
+    0x12, 0x06 // jump back to the first 8xy4
+};
+
+// Dxyn of a 5 row font glyph that walks across the screen
+const std::vector<uint8_t> drawRom
+{
+    0x60, 0x00, 0x61, 0x00, 0xA0, 0x00,
+    0xD0, 0x15, 0x70, 0x05, 0x71, 0x03, 0xD0, 0x15,
+    0x12, 0x06
+};
+
+// Fx55/Fx65 of all sixteen registers to and from a scratch area
+const std::vector<uint8_t> memoryRom
+{
+    0xA3, 0x00, 0xFF, 0x55, 0xA3, 0x00, 0xFF, 0x65, 0x70, 0x01,
+    0x12, 0x00
+};
+
+// 2nnn/00EE pairs and 1nnn between them
+const std::vector<uint8_t> branchRom
+{
+    0x22, 0x08, 0x22, 0x0A, 0x12, 0x00, 0x00, 0x00,
+    0x70, 0x01, // 0x208
+    0x00, 0xEE, // 0x20A
+};
+
+// a game-shaped mix: a delay timer wait, random input-dependent movement,
+// BCD score drawing through a subroutine, and a sprite redrawn every pass
+const std::vector<uint8_t> gameRom
+{
+    0x6A, 0x10, 0x6B, 0x08, 0x6C, 0x00,             // 0x200 player x, y and score
+    0xA2, 0x40, 0xDA, 0xB4,                         // 0x206 erase player
+    0xC0, 0x03, 0x60, 0x01, 0xE0, 0x9E, 0x7A, 0x01, // 0x20A random step, key 1 moves right
+    0x61, 0x02, 0xE1, 0xA1, 0x7B, 0x01,             // 0x212 key 2 not held moves down
+    0x8A, 0x02, 0x4A, 0x00, 0x7C, 0x01,             // 0x218 x & V0, score when it hits 0
+    0xA2, 0x40, 0xDA, 0xB4,                         // 0x21E draw player
+    0x22, 0x30,                                     // 0x222 draw score
+    0xF2, 0x07, 0x32, 0x00, 0x12, 0x24,             // 0x224 wait until the delay timer runs out
+    0x62, 0x01, 0xF2, 0x15,                         // 0x22A restart it
+    0x12, 0x06,                                     // 0x22E
+    0xA2, 0x50, 0xFC, 0x33, 0xF2, 0x65,             // 0x230 score to BCD and back
+    0xF0, 0x29, 0x63, 0x30, 0x64, 0x00, 0xD3, 0x45, // 0x236 draw the hundreds digit
+    0x00, 0xEE,                                     // 0x23E
+    0xF0, 0x90, 0x90, 0xF0                          // 0x240 player sprite
+};
+
+struct Result {
+    const char* name;
+    double instructionsPerSecond;
+    double nsPerInstruction;
+    double stddevNs; // across repetitions
+    double fastForwarded; // share of the instructions counted through idle loops rather than run
+};
+
+// units[i] is how many instructions or frames repetition i actually got through in seconds[i]
+Result summarize(const char* name, const std::vector<double>& seconds, const std::vector<double>& units)
+{
+    double mean = 0;
+    for (size_t i = 0; i < seconds.size(); ++i)
+    {
+        mean += seconds[i] * 1e9 / units[i];
+    }
+    mean /= seconds.size();
+
+    double variance = 0;
+    for (size_t i = 0; i < seconds.size(); ++i)
+    {
+        double ns = seconds[i] * 1e9 / units[i];
+        variance += (ns - mean) * (ns - mean);
+    }
+    variance /= seconds.size();
+
+    return Result{ name, 1e9 / mean, mean, std::sqrt(variance), 0 };
+}
+
+// fast-forwarding is off unless asked for, so the rows measure the same work as releases before it existed
+Result runRom(const char* name, const std::vector<uint8_t>& rom, int cycles, bool useJit, bool fastForward = false)
+{
+    std::vector<double> seconds;
+    std::vector<double> units;
+    uint64_t ran = 0;
+    uint64_t skipped = 0;
+    for (auto rep = 0; rep < REPETITIONS; ++rep)
+    {
+        std::unique_ptr<Chip8> chip(new Chip8());
+        chip->fastForward = fastForward;
+        chip->loadBytes(rom.data(), rom.size());
+        chip->PC = PROGRAM_ADDRESS;
+        std::unique_ptr<Jit> jit(useJit ? new Jit(*chip) : nullptr);
+        uint16_t keyUp = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto left = cycles; left > 0 && !chip->halt; left -= BENCH_BATCH)
+        {
+            int batch = left < BENCH_BATCH ? left : BENCH_BATCH;
+            if (jit)
+            {
+                jit->runCycles(batch, 0x0002, keyUp);
+            }
+            else
+            {
+                chip->runCycles(batch, 0x0002, keyUp);
+            }
+            chip->tickTimers();
+        }
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        // the rate is over what actually executed: a program that halts early still gets a true figure,
+        // and instructions fast-forwarded through idle loops, counted but never run, are left out
+        uint64_t executed = chip->cycleCount - chip->idleCycles;
+        units.push_back(executed ? executed : 1);
+        ran += chip->cycleCount;
+        skipped += chip->idleCycles;
+    }
+    Result result = summarize(name, seconds, units);
+    result.fastForwarded = ran ? (double)skipped / ran : 0;
+    return result;
+}
+
+// cost of turning the packed screen into ARGB for a presented frame, per frame rather than per instruction
+Result runPresent(const char* name, int frames, bool dirtyRowsOnly)
+{
+    std::unique_ptr<Chip8> chip(new Chip8());
+    for (auto y = 0; y < LORES_HEIGHT; ++y)
+    {
+        chip->screen[0][y][0] = 0x9E3779B97F4A7C15 * (y + 1);
+    }
+    std::vector<uint32_t> pixels(LORES_WIDTH * LORES_HEIGHT);
+
+    std::vector<double> seconds;
+    for (auto rep = 0; rep < REPETITIONS; ++rep)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (auto frame = 0; frame < frames; ++frame)
+        {
+            // a typical frame moves a couple of sprites, a handful of rows
+            int first = dirtyRowsOnly ? frame % (LORES_HEIGHT - 6) : 0;
+            int rows = dirtyRowsOnly ? 6 : LORES_HEIGHT;
+            chip->renderScreen(&pixels[first * LORES_WIDTH], LORES_WIDTH * 4, first, rows);
+        }
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return summarize(name, seconds, std::vector<double>(seconds.size(), frames));
+}
+
+void usage()
+{
+    printf("usage: chip8-bench [-c cycles] [-json]\n");
+    printf("       cycles is at least %d, the present rows draw a frame per %d of them\n", CYCLES_PER_PRESENT, CYCLES_PER_PRESENT);
+    exit(1);
+}
+
+// Measures the interpreter per opcode family, whole synthetic programs on
+// each engine, and frame presentation, so releases can be compared.
+int main(int argc, char* argv[])
+{
+    int cycles = DEFAULT_BENCH_CYCLES;
+    bool json = false;
+
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (!std::strcmp(argv[i], "-c") && i + 1 < argc && std::atoi(argv[i + 1]) >= CYCLES_PER_PRESENT)
+        {
+            cycles = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-json"))
+        {
+            json = true;
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    std::vector<Result> results;
+    results.push_back(runRom("alu", aluRom, cycles, false));
+    results.push_back(runRom("draw", drawRom, cycles, false));
+    results.push_back(runRom("memory", memoryRom, cycles, false));
+    results.push_back(runRom("branch", branchRom, cycles, false));
+    results.push_back(runRom("game", gameRom, cycles, false));
+    results.push_back(runRom("game-idle", gameRom, cycles, false, true));
+    results.push_back(runRom("alu-jit", aluRom, cycles, true));
+    results.push_back(runRom("game-jit", gameRom, cycles, true));
+    results.push_back(runPresent("present-full", cycles / CYCLES_PER_PRESENT, false));
+    results.push_back(runPresent("present-dirty", cycles / CYCLES_PER_PRESENT, true));
+
+    if (json)
+    {
+        printf("{\n  \"repetitions\": %d,\n  \"results\": [\n", REPETITIONS);
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            printf("    {\"name\": \"%s\", \"per_second\": %.0f, \"ns_each\": %.3f, \"stddev_ns\": %.3f, \"fast_forwarded\": %.4f}%s\n",
+                r.name, r.instructionsPerSecond, r.nsPerInstruction, r.stddevNs, r.fastForwarded, i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+        return 0;
+    }
+
+    // present-* rows count frames rather than instructions; the others rate only instructions that executed, and
+    // fast-fwd is the share of a row's counted instructions skipped through idle loops, only game-idle lets the core do that
+    printf("%-16s %16s %12s %12s %10s\n", "benchmark", "per second", "ns each", "stddev ns", "fast-fwd");
+    for (const Result& r : results)
+    {
+        printf("%-16s %16.0f %12.3f %12.3f %9.1f%%\n", r.name, r.instructionsPerSecond, r.nsPerInstruction, r.stddevNs, r.fastForwarded * 100);
+    }
+}
@@ -1,8 +1,12 @@
-#include <SDL2/SDL.h>
 #include <algorithm>
-#include <limits>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include "chip8.h"
+#include "audio.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
 
 // Font
 constexpr int FONT_SIZE = 80;
@@ -26,81 +30,215 @@ const std::array<uint8_t, FONT_SIZE> font
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-const std::array<uint8_t, 0x10> keyBindings
-{
-    
-    SDL_SCANCODE_X, // 0
-    SDL_SCANCODE_1, // 1
-    SDL_SCANCODE_2, // 2
-    SDL_SCANCODE_3, // 3
-    SDL_SCANCODE_Q, // 4
-    SDL_SCANCODE_W, // 5
-    SDL_SCANCODE_E, // 6
-    SDL_SCANCODE_A, // 7
-    SDL_SCANCODE_S, // 8
-    SDL_SCANCODE_D, // 9
-    SDL_SCANCODE_Z, // A
-    SDL_SCANCODE_C, // B
-    SDL_SCANCODE_4, // C
-    SDL_SCANCODE_R, // D
-    SDL_SCANCODE_F, // E
-    SDL_SCANCODE_V  // F
+// SUPER-CHIP large font, loaded at BIG_FONT_ADDRESS
+constexpr int BIG_FONT_SIZE = 160;
+const std::array<uint8_t, BIG_FONT_SIZE> bigFont
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
 };
+static_assert(BIG_FONT_ADDRESS >= FONT_SIZE && BIG_FONT_ADDRESS + BIG_FONT_SIZE <= PROGRAM_ADDRESS, "fonts must fit below programs");
 
-Chip8::Chip8(): mem{}, screen{}, V{}, stack{}, I(0), DT(0), ST(0), PC(0), SP(0), screenDrawn(false)
+Chip8::Chip8(): mem{}, decoded{}, screen{}, planes(1), hires(false), V{}, stack{}, I(0), DT(0), ST(0), PC(0), SP(0), rngState{}, rpl{}, audioPattern{}, pitch(DEFAULT_PITCH), halt(HALT_NONE), cycleCount(0), idleCycles(0), codeVersion(0), quirks(QUIRKS_MODERN), fastForward(true), memUsed(BASE_MEM_SIZE), dirtyRows(ALL_ROWS)
+#ifdef CHIP8_TRACE
+    , trace(nullptr)
+#endif
+#ifdef CHIP8_PROFILE
+    , profiler(nullptr)
+#endif
+    , sound(nullptr)
 {
-    std::srand(1);
     for (auto i=0; i < FONT_SIZE; ++i)
     {
         mem[i] = font[i];
     }
-    for (auto i=0; i < SCREEN_HEIGHT * SCREEN_WIDTH; ++i)
+    for (auto i=0; i < BIG_FONT_SIZE; ++i)
     {
-        screen[i] = 0xFF000000;
+        mem[BIG_FONT_ADDRESS + i] = bigFont[i];
     }
+    seedRandom(DEFAULT_SEED);
+    // until F002 loads a pattern the buzzer is a 500 hz square wave, so CHIP-8 programs still beep
+    std::fill(audioPattern, audioPattern + AUDIO_PATTERN_SIZE, 0xF0);
 }
 
-bool Chip8::loadFile(std::string filename)
+bool Chip8::loadFile(std::string filename, QuirkProfile profile)
 {
-    std::ifstream chipFile = std::ifstream(filename, std::ios_base::binary);
+    std::ifstream chipFile(filename, std::ios_base::binary | std::ios_base::ate);
     if (!chipFile)
     {
         printf("File not found\n");
         return false;
     }
 
-    chipFile.ignore(std::numeric_limits<std::streamsize>::max());
-    std::streamsize length = chipFile.gcount();
-    chipFile.clear();
+    // opened at the end, so the position is the length and the file is read once
+    std::streamsize length = chipFile.tellg();
+    if (length > (MEM_SIZE - PROGRAM_ADDRESS))
+    {
+        printf("File too large\n");
+        return false;
+    }
+
     chipFile.seekg(0, std::ios_base::beg);
+    if (!chipFile.read(reinterpret_cast<char*>(&mem[PROGRAM_ADDRESS]), length))
+    {
+        printf("Could not read %s\n", filename.c_str());
+        return false;
+    }
 
+    if (PROGRAM_ADDRESS + length > memUsed)
+    {
+        memUsed = MEM_SIZE;
+    }
+    quirks = profile;
+    resetCode();
+
+    return true;
+}
+
+bool Chip8::loadBytes(const uint8_t* data, size_t length, QuirkProfile profile)
+{
     if (length > (MEM_SIZE - PROGRAM_ADDRESS))
     {
         printf("File too large\n");
-        chipFile.close();
         return false;
     }
 
-    char buffer[length];
-    
-    chipFile.read(reinterpret_cast<char*>(&mem[PROGRAM_ADDRESS]), length);
-    chipFile.close();
+    std::copy(data, data + length, &mem[PROGRAM_ADDRESS]);
+    if (PROGRAM_ADDRESS + length > memUsed)
+    {
+        memUsed = MEM_SIZE;
+    }
+    quirks = profile;
+    resetCode();
 
     return true;
+}
+
+void Chip8::resetCode()
+{
+    // drop anything decoded from the previous contents of memory
+    std::fill(decoded, decoded + MEM_SIZE, Instruction{});
+    ++codeVersion;
+}
+
+bool parseQuirkProfile(const char* name, QuirkProfile& profile)
+{
+    for (auto i = 0; i < QUIRK_PROFILE_COUNT; ++i)
+    {
+        if (!std::strcmp(name, QUIRK_PROFILE_NAMES[i]))
+        {
+            profile = (QuirkProfile)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t hashBytes(const void* data, size_t length, uint64_t hash)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+uint64_t Chip8::hashScreen() const
+{
+    return hashBytes(&hires, sizeof(hires), hashBytes(screen, sizeof(screen)));
+}
+
+uint64_t Chip8::hashState() const
+{
+    uint64_t hash = hashBytes(mem, memUsed);
+    hash = hashBytes(screen, sizeof(screen), hash);
+    hash = hashBytes(&hires, sizeof(hires), hash);
+    hash = hashBytes(&planes, sizeof(planes), hash);
+    hash = hashBytes(V, sizeof(V), hash);
+    hash = hashBytes(stack, sizeof(stack), hash);
+    hash = hashBytes(&I, sizeof(I), hash);
+    hash = hashBytes(&DT, sizeof(DT), hash);
+    hash = hashBytes(&ST, sizeof(ST), hash);
+    hash = hashBytes(&PC, sizeof(PC), hash);
+    hash = hashBytes(&SP, sizeof(SP), hash);
+    hash = hashBytes(rngState, sizeof(rngState), hash);
+    hash = hashBytes(rpl, sizeof(rpl), hash);
+    hash = hashBytes(audioPattern, sizeof(audioPattern), hash);
+    hash = hashBytes(&pitch, sizeof(pitch), hash);
+    return hashBytes(&halt, sizeof(halt), hash);
+}
+
+// a frame of a typical program writes a few bytes, so whole pages are compared first and only a page that
+// differs is walked, in words, for the bytes to store
+void Chip8::storeBytes(const uint8_t* bytes, uint32_t length)
+{
+    constexpr uint32_t PAGE = 256;
+    for (uint32_t page = 0; page < length; page += PAGE)
+    {
+        if (std::memcmp(&mem[page], &bytes[page], PAGE) == 0)
+        {
+            continue;
+        }
+        for (auto addr = page; addr < page + PAGE; addr += 8)
+        {
+            if (std::memcmp(&mem[addr], &bytes[addr], 8) == 0)
+            {
+                continue;
+            }
+            for (auto i = addr; i < addr + 8; ++i)
+            {
+                if (mem[i] != bytes[i])
+                {
+                    storeByte(i, bytes[i]);
+                }
+            }
+        }
+    }
+}
+
+static_assert(MEM_SIZE % 256 == 0 && BASE_MEM_SIZE % 256 == 0, "storeBytes compares whole 256 byte pages");
+static_assert(offsetof(Chip8, screen) == offsetof(Chip8, decoded) + sizeof(Chip8::decoded), "copyState copies everything after mem and decoded as one block");
 
+void Chip8::copyState(const Chip8& from)
+{
+    storeBytes(from.mem, std::max(memUsed, from.memUsed));
+
+    // everything after the decode cache is plain state, and memory now matches from's up to its memUsed
+    const size_t start = offsetof(Chip8, screen);
+    std::memcpy(reinterpret_cast<char*>(this) + start, reinterpret_cast<const char*>(&from) + start, sizeof(Chip8) - start);
 }
 
-void Chip8::runCycle(const uint8_t* keyboardState, bool* keyUp)
+void Chip8::decode(uint16_t addr)
 {
-    uint8_t leftByte = mem[PC];
-    uint8_t rightByte = mem[PC + 1];
+    uint8_t leftByte = mem[addr & ADDRESS_MASK];
+    uint8_t rightByte = mem[(addr + 1) & ADDRESS_MASK];
     uint16_t opcode = ((uint16_t)leftByte << 8) + (rightByte);
 
-    printf("op %04hX ad %04hX\n", opcode, PC);
+    Instruction& ins = decoded[addr & ADDRESS_MASK];
 
-    // variables for readability when these nibbles are used by an instruction to specify a register
-    uint8_t x = leftByte & 0x0F;
-    uint8_t y = rightByte >> 4;
+    // operands are extracted once here so the handlers never touch the raw opcode
+    ins.x = leftByte & 0x0F;
+    ins.y = rightByte >> 4;
+    ins.n = rightByte & 0x0F;
+    ins.nn = rightByte;
+    ins.nnn = opcode & 0x0FFF;
+    ins.op = OP_INVALID;
 
     switch (opcode & 0xF000)
     {
@@ -108,168 +246,674 @@ void Chip8::runCycle(const uint8_t* keyboardState, bool* keyUp)
             switch (opcode & 0x0FFF)
             {
                 case (0x00E0):
-                    clearScreen();
+                    ins.op = OP_CLS;
                     break;
                 case (0x00EE):
-                    returnFromSubroutine();
+                    ins.op = OP_RET;
+                    break;
+                case (0x00FB):
+                    ins.op = OP_SCR;
                     break;
+                case (0x00FC):
+                    ins.op = OP_SCL;
+                    break;
+                case (0x00FD):
+                    ins.op = OP_EXIT;
+                    break;
+                case (0x00FE):
+                    ins.op = OP_LOW;
+                    break;
+                case (0x00FF):
+                    ins.op = OP_HIGH;
+                    break;
+                default:
+                    if ((opcode & 0x0FF0) == 0x00C0)
+                    {
+                        ins.op = OP_SCD;
+                    }
+                    else if ((opcode & 0x0FF0) == 0x00D0)
+                    {
+                        ins.op = OP_SCU;
+                    }
+                    else
+                    {
+                        ins.op = OP_SYS; // machine code routines are ignored
+                    }
             }
             break;
         case (0x1000):
-            jump(opcode & 0x0FFF);
+            ins.op = fastForward && pollingLoop(addr & ADDRESS_MASK, ins.nnn) ? OP_JP_LOOP : OP_JP;
             break;
         case (0x2000):
-            call(opcode & 0x0FFF);
+            ins.op = OP_CALL;
             break;
         case (0x3000):
-            skipEquals(V[x], rightByte);
+            ins.op = OP_SE_BYTE;
             break;
         case (0x4000):
-            skipNotEquals(V[x], rightByte);
+            ins.op = OP_SNE_BYTE;
             break;
         case (0x5000):
-            if ((opcode & 0xF) == 0x0)
-            {
-                skipEquals(V[x], V[y]);
-            }
-            else
+            switch (opcode & 0xF)
             {
-                invalidOpcode(opcode);
+                case (0x0):
+                    ins.op = OP_SE_REG;
+                    break;
+                case (0x2):
+                    ins.op = OP_SAVE_RANGE;
+                    break;
+                case (0x3):
+                    ins.op = OP_LOAD_RANGE;
+                    break;
             }
             break;
         case (0x6000):
-            loadRegister(x, rightByte);
+            ins.op = OP_LD_BYTE;
             break;
         case (0x7000):
-            add(x, rightByte);
+            ins.op = OP_ADD_BYTE;
             break;
         case (0x8000):
             switch (opcode & 0xF)
             {
                 case (0x0):
-                    loadRegister(x, V[y]);
+                    ins.op = OP_LD_REG;
                     break;
                 case (0x1):
-                    orOp(x, y);
+                    ins.op = OP_OR;
                     break;
                 case (0x2):
-                    andOp(x, y);
+                    ins.op = OP_AND;
                     break;
                 case (0x3):
-                    xorOp(x, y);
+                    ins.op = OP_XOR;
                     break;
                 case (0x4):
-                    addCarry(x, y);
+                    ins.op = OP_ADD_REG;
                     break;
                 case (0x5):
-                    subtract(x, y);
+                    ins.op = OP_SUB;
                     break;
                 case (0x6):
-                    shiftRight(x);
+                    ins.op = OP_SHR;
                     break;
                 case (0x7):
-                    subtractSwapped(x, y);
+                    ins.op = OP_SUBN;
                     break;
                 case (0xE):
-                    shiftLeft(x);
+                    ins.op = OP_SHL;
                     break;
-                default:
-                    invalidOpcode(opcode);
             }
             break;
         case (0x9000):
             if ((opcode & 0xF) == 0x0)
             {
-                skipNotEquals(V[x], V[y]);
-            }
-            else
-            {
-                invalidOpcode(opcode);
+                ins.op = OP_SNE_REG;
             }
             break;
         case (0xA000):
-            loadAddr(opcode & 0x0FFF);
+            ins.op = OP_LD_I;
             break;
         case (0xB000):
-            jump(V[0] + (opcode & 0x0FFF));
+            ins.op = OP_JP_V0;
             break;
         case (0xC000):
-            random(x, rightByte);
+            ins.op = OP_RND;
             break;
         case (0xD000):
-            draw(x, y, opcode & 0x000F);
+            ins.op = OP_DRW;
             break;
         case (0xE000):
             switch (rightByte)
             {
                 case (0x9E):
-                    skipKeyPressed(x, keyboardState);
+                    ins.op = OP_SKP;
                     break;
                 case (0xA1):
-                    skipNotPressed(x, keyboardState);
+                    ins.op = OP_SKNP;
                     break;
-                default:
-                    invalidOpcode(opcode);
             }
             break;
         case (0xF000):
             switch (rightByte)
             {
+                case (0x00):
+                    if (ins.x == 0)
+                    {
+                        ins.op = OP_LD_LONG;
+                    }
+                    break;
+                case (0x01):
+                    ins.op = OP_PLANE;
+                    break;
+                case (0x02):
+                    if (ins.x == 0)
+                    {
+                        ins.op = OP_AUDIO;
+                    }
+                    break;
                 case (0x07):
-                    loadFromDelayTimer(x);
+                    ins.op = OP_LD_VX_DT;
                     break;
                 case (0x0A):
-                    waitKeyPress(x, keyUp);
+                    ins.op = OP_LD_K;
                     break;
                 case (0x15):
-                    setDelayTimer(x);
+                    ins.op = OP_LD_DT;
                     break;
                 case (0x18):
-                    setSoundTimer(x);
+                    ins.op = OP_LD_ST;
                     break;
                 case (0x1E):
-                    addAddressRegister(x);
+                    ins.op = OP_ADD_I;
                     break;
                 case (0x29):
-                    loadFont(x);
+                    ins.op = OP_LD_F;
+                    break;
+                case (0x30):
+                    ins.op = OP_LD_HF;
+                    break;
+                case (0x3A):
+                    ins.op = OP_PITCH;
                     break;
                 case(0x33):
-                    loadBCD(x);
+                    ins.op = OP_LD_B;
                     break;
                 case(0x55):
-                    storeRegisters(x);
+                    ins.op = OP_LD_STORE;
                     break;
                 case (0x65):
-                    readRegisters(x);
+                    ins.op = OP_LD_READ;
+                    break;
+                case (0x75):
+                    ins.op = OP_LD_R;
+                    break;
+                case (0x85):
+                    ins.op = OP_LD_VX_R;
                     break;
-                default:
-                    invalidOpcode(opcode);
             }
             break;
+    }
+}
+
+void Chip8::invalidateCode(uint16_t addr)
+{
+    // an instruction starting one byte earlier also contains this address
+    Instruction& at = decoded[addr & ADDRESS_MASK];
+    Instruction& before = decoded[(addr - 1) & ADDRESS_MASK];
+
+    // writing over decoded code also stales anything translated from it
+    if (at.op != OP_DECODE || before.op != OP_DECODE)
+    {
+        ++codeVersion;
+    }
+
+    at.op = OP_DECODE;
+    before.op = OP_DECODE;
+}
+
+void Chip8::storeByte(uint16_t addr, uint8_t byte)
+{
+    if ((addr & ADDRESS_MASK) >= memUsed)
+    {
+        memUsed = MEM_SIZE;
+    }
+    mem[addr & ADDRESS_MASK] = byte;
+    invalidateCode(addr);
+}
+
+void Chip8::runCycle(uint16_t keypad, uint16_t& keyUp)
+{
+    runCycles(1, keypad, keyUp);
+}
+
+// picks the interpreter compiled for this ROM's quirks, once per batch rather than per instruction
+void Chip8::runCycles(int cycles, uint16_t keypad, uint16_t& keyUp)
+{
+    if (halt)
+    {
+        return;
+    }
+
+    switch (quirks)
+    {
+        case (QUIRKS_COSMAC_VIP):
+            runCyclesAs<QUIRKS_COSMAC_VIP>(cycles, keypad, keyUp);
+            break;
+        case (QUIRKS_CHIP48):
+            runCyclesAs<QUIRKS_CHIP48>(cycles, keypad, keyUp);
+            break;
+        case (QUIRKS_SUPERCHIP):
+            runCyclesAs<QUIRKS_SUPERCHIP>(cycles, keypad, keyUp);
+            break;
+        case (QUIRKS_XOCHIP):
+            runCyclesAs<QUIRKS_XOCHIP>(cycles, keypad, keyUp);
+            break;
         default:
-            invalidOpcode(opcode);
+            runCyclesAs<QUIRKS_MODERN>(cycles, keypad, keyUp);
+            break;
+    }
+}
+
+// Executes instructions out of the pre-decoded table using threaded dispatch:
+// every handler jumps straight to the next instruction's handler through a
+// computed goto instead of returning to a central switch.
+template <QuirkProfile P>
+void Chip8::runCyclesAs(int cycles, uint16_t keypad, uint16_t& keyUp)
+{
+    static void* const handlers[OP_COUNT] =
+    {
+        &&op_decode, &&op_invalid, &&op_sys, &&op_cls, &&op_ret, &&op_jp, &&op_call,
+        &&op_se_byte, &&op_sne_byte, &&op_se_reg, &&op_ld_byte, &&op_add_byte,
+        &&op_ld_reg, &&op_or, &&op_and, &&op_xor, &&op_add_reg, &&op_sub, &&op_shr,
+        &&op_subn, &&op_shl, &&op_sne_reg, &&op_ld_i, &&op_jp_v0, &&op_rnd, &&op_drw,
+        &&op_skp, &&op_sknp, &&op_ld_vx_dt, &&op_ld_k, &&op_ld_dt, &&op_ld_st,
+        &&op_add_i, &&op_ld_f, &&op_ld_b, &&op_ld_store, &&op_ld_read,
+        &&op_scd, &&op_scr, &&op_scl, &&op_exit, &&op_low, &&op_high,
+        &&op_ld_hf, &&op_ld_r, &&op_ld_vx_r,
+        &&op_scu, &&op_ld_long, &&op_save_range, &&op_load_range, &&op_plane,
+        &&op_audio, &&op_pitch,
+        &&op_jp_loop
+    };
+
+    const Instruction* ins;
+
+#ifdef CHIP8_PROFILE
+    ProfileTimer runTimer(profiler ? &profiler->runNanos : nullptr);
+#define PROFILE_INSTRUCTION() \
+    if (profiler) profiler->instruction(PC, mem[PC & ADDRESS_MASK])
+#else
+#define PROFILE_INSTRUCTION()
+#endif
+
+    // every requested instruction runs unless the program halts, which takes back the ones it skipped
+    cycleCount += cycles;
+
+#ifdef CHIP8_TRACE
+#define TRACE_INSTRUCTION() \
+    if (trace) trace->push(PC, ((uint16_t)mem[PC & ADDRESS_MASK] << 8) + mem[(PC + 1) & ADDRESS_MASK])
+#else
+#define TRACE_INSTRUCTION()
+#endif
+
+// fetch the next pre-decoded instruction and jump to its handler
+#define DISPATCH() \
+    do { \
+        if (cycles-- <= 0) return; \
+        ins = &decoded[PC & ADDRESS_MASK]; \
+        TRACE_INSTRUCTION(); \
+        PROFILE_INSTRUCTION(); \
+        goto *handlers[ins->op]; \
+    } while (0)
+
+// increment program counter, then dispatch
+#define NEXT() \
+    do { \
+        PC += 2; \
+        DISPATCH(); \
+    } while (0)
+
+    DISPATCH();
+
+op_decode:
+    // first execution at this address (or its bytes were overwritten): decode, then run it
+    decode(PC);
+    goto *handlers[ins->op];
+op_invalid:
+    invalidOpcode(((uint16_t)mem[PC & ADDRESS_MASK] << 8) + mem[(PC + 1) & ADDRESS_MASK]);
+    // PC stays on the faulting instruction, which did not run
+    cycleCount -= cycles + 1;
+    return;
+op_sys:
+    NEXT();
+op_cls:
+    clearScreen();
+    NEXT();
+op_ret:
+    if (!returnFromSubroutine())
+    {
+        cycleCount -= cycles + 1;
+        return;
     }
+    NEXT();
+op_jp:
+    jump(ins->nnn);
+    NEXT();
+op_call:
+    if (!call(ins->nnn))
+    {
+        cycleCount -= cycles + 1;
+        return;
+    }
+    NEXT();
+op_se_byte:
+    skipEquals(V[ins->x], ins->nn);
+    NEXT();
+op_sne_byte:
+    skipNotEquals(V[ins->x], ins->nn);
+    NEXT();
+op_se_reg:
+    skipEquals(V[ins->x], V[ins->y]);
+    NEXT();
+op_ld_byte:
+    loadRegister(ins->x, ins->nn);
+    NEXT();
+op_add_byte:
+    add(ins->x, ins->nn);
+    NEXT();
+op_ld_reg:
+    loadRegister(ins->x, V[ins->y]);
+    NEXT();
+op_or:
+    orOp<P>(ins->x, ins->y);
+    NEXT();
+op_and:
+    andOp<P>(ins->x, ins->y);
+    NEXT();
+op_xor:
+    xorOp<P>(ins->x, ins->y);
+    NEXT();
+op_add_reg:
+    addCarry(ins->x, ins->y);
+    NEXT();
+op_sub:
+    subtract(ins->x, ins->y);
+    NEXT();
+op_shr:
+    shiftRight<P>(ins->x, ins->y);
+    NEXT();
+op_subn:
+    subtractSwapped(ins->x, ins->y);
+    NEXT();
+op_shl:
+    shiftLeft<P>(ins->x, ins->y);
+    NEXT();
+op_sne_reg:
+    skipNotEquals(V[ins->x], V[ins->y]);
+    NEXT();
+op_ld_i:
+    loadAddr(ins->nnn);
+    NEXT();
+op_jp_v0:
+    jump(V[QUIRK_PROFILES[P].jumpUsesVx ? ins->x : 0] + ins->nnn);
+    NEXT();
+op_rnd:
+    random(ins->x, ins->nn);
+    NEXT();
+op_drw:
+    draw<P>(ins->x, ins->y, ins->n);
+    NEXT();
+op_skp:
+    skipKeyPressed(ins->x, keypad);
+    NEXT();
+op_sknp:
+    skipNotPressed(ins->x, keypad);
+    NEXT();
+op_ld_vx_dt:
+    loadFromDelayTimer(ins->x);
+    NEXT();
+op_ld_k:
+    if (fastForward && !(keyUp & ((1 << KEY_COUNT) - 1)))
+    {
+        // no key comes up before the frame ends, so every remaining cycle would wait here again
+        idleCycles += cycles;
+        cycles = 0;
+    }
+    waitKeyPress(ins->x, keyUp);
+    NEXT();
+op_ld_dt:
+    setDelayTimer(ins->x);
+    NEXT();
+op_ld_st:
+    // cycles has already been counted down past this instruction
+    setSoundTimer(ins->x, cycleCount - cycles - 1);
+    NEXT();
+op_add_i:
+    addAddressRegister(ins->x);
+    NEXT();
+op_ld_f:
+    loadFont(ins->x);
+    NEXT();
+op_ld_b:
+    loadBCD(ins->x);
+    NEXT();
+op_ld_store:
+    storeRegisters<P>(ins->x);
+    NEXT();
+op_ld_read:
+    readRegisters<P>(ins->x);
+    NEXT();
+op_scd:
+    scrollDown(ins->n);
+    NEXT();
+op_scr:
+    scrollRight();
+    NEXT();
+op_scl:
+    scrollLeft();
+    NEXT();
+op_exit:
+    exitProgram();
+    cycleCount -= cycles;
+    return;
+op_low:
+    setResolution(false);
+    NEXT();
+op_high:
+    setResolution(true);
+    NEXT();
+op_ld_hf:
+    loadBigFont(ins->x);
+    NEXT();
+op_ld_r:
+    storeFlags(ins->x);
+    NEXT();
+op_ld_vx_r:
+    readFlags(ins->x);
+    NEXT();
+op_scu:
+    scrollUp(ins->n);
+    NEXT();
+op_ld_long:
+    // F000 nnnn, the address word is read as it runs so writes to it need no invalidation
+    loadLong(((uint16_t)mem[(PC + 2) & ADDRESS_MASK] << 8) + mem[(PC + 3) & ADDRESS_MASK]);
+    PC += 2;
+    NEXT();
+op_save_range:
+    storeRange(ins->x, ins->y);
+    NEXT();
+op_load_range:
+    readRange(ins->x, ins->y);
+    NEXT();
+op_plane:
+    selectPlanes(ins->x);
+    NEXT();
+op_audio:
+    loadAudioPattern(cycleCount - cycles - 1);
+    NEXT();
+op_pitch:
+    setPitch(ins->x, cycleCount - cycles - 1);
+    NEXT();
+op_jp_loop:
+    // a loop that polls DT or the keypad runs the same way until a timer tick or new input,
+    // so whole turns of it are counted rather than run; the rest of a turn is interpreted to land on the same PC
+    if (int period = idleLoopLength(PC & ADDRESS_MASK, ins->nnn, keypad))
+    {
+        int skipped = cycles - cycles % period;
+        cycles -= skipped;
+        idleCycles += skipped;
+    }
+    jump(ins->nnn);
+    NEXT();
 
-    PC += 2; // increment program counter
+#undef NEXT
+#undef DISPATCH
+#undef TRACE_INSTRUCTION
+#undef PROFILE_INSTRUCTION
+}
+
+void Chip8::runFrame(int cycles, uint16_t keypad, uint16_t& keyUp)
+{
+    runCycles(cycles, keypad, keyUp);
+    tickTimers();
+}
+
+void Chip8::tickTimers()
+{
+    if (ST && !--ST)
+        soundChanged(cycleCount);
+    if (DT)
+        DT--;
+}
+
+void Chip8::soundChanged(uint64_t cycle)
+{
+    if (sound)
+    {
+        sound->push(*this, cycle);
+    }
 }
 
 void Chip8::invalidOpcode(uint16_t opcode)
 {
     printf("Invalid opcode %04hX at address %04hX, program terminated\n", opcode, PC);
-    exit(1);
+    halt = HALT_INVALID;
 }
 
+// clears the selected planes only
 void Chip8::clearScreen() 
 {
-    const uint32_t zeroTest = 0;
-    std::fill(screen, screen+(SCREEN_WIDTH*SCREEN_HEIGHT), zeroTest);
-    screenDrawn = true;
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (!(planes & (1 << p)))
+        {
+            continue;
+        }
+        for (auto y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            if (screen[p][y][0] | screen[p][y][1])
+            {
+                dirtyRows |= (uint64_t)1 << y;
+            }
+        }
+        std::memset(screen[p], 0, sizeof(screen[p]));
+    }
+}
+
+// Scrolls move whole rows and shift whole words rather than single pixels, in the selected planes only.
+// Distances are in pixels of the current resolution.
+void Chip8::scrollDown(uint8_t n)
+{
+    int rows = height();
+    if (n > rows)
+    {
+        n = rows;
+    }
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (planes & (1 << p))
+        {
+            std::memmove(screen[p][n], screen[p][0], (rows - n) * sizeof(screen[p][0]));
+            std::memset(screen[p][0], 0, n * sizeof(screen[p][0]));
+        }
+    }
+    dirtyRows |= ALL_ROWS >> (HIRES_HEIGHT - rows);
+}
+
+void Chip8::scrollUp(uint8_t n)
+{
+    int rows = height();
+    if (n > rows)
+    {
+        n = rows;
+    }
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (planes & (1 << p))
+        {
+            std::memmove(screen[p][0], screen[p][n], (rows - n) * sizeof(screen[p][0]));
+            std::memset(screen[p][rows - n], 0, n * sizeof(screen[p][0]));
+        }
+    }
+    dirtyRows |= ALL_ROWS >> (HIRES_HEIGHT - rows);
+}
+
+void Chip8::scrollRight()
+{
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (!(planes & (1 << p)))
+        {
+            continue;
+        }
+        for (auto y = 0; y < height(); ++y)
+        {
+            uint64_t* row = screen[p][y];
+            if (!(row[0] | row[1]))
+            {
+                continue;
+            }
+            // pixels pushed past the right edge fall off
+            if (hires)
+            {
+                row[1] = (row[1] >> 4) | (row[0] << 60);
+            }
+            row[0] >>= 4;
+            dirtyRows |= (uint64_t)1 << y;
+        }
+    }
+}
+
+void Chip8::scrollLeft()
+{
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (!(planes & (1 << p)))
+        {
+            continue;
+        }
+        for (auto y = 0; y < height(); ++y)
+        {
+            uint64_t* row = screen[p][y];
+            if (!(row[0] | row[1]))
+            {
+                continue;
+            }
+            row[0] = (row[0] << 4) | (row[1] >> 60);
+            row[1] <<= 4;
+            dirtyRows |= (uint64_t)1 << y;
+        }
+    }
 }
 
-void Chip8::returnFromSubroutine() 
+void Chip8::exitProgram()
 {
+    halt = HALT_EXIT;
+}
+
+// switching resolution starts from a blank screen
+void Chip8::setResolution(bool high)
+{
+    hires = high;
+    std::memset(screen, 0, sizeof(screen));
+    dirtyRows = ALL_ROWS;
+}
+
+// halts the program with PC left on the faulting instruction, which does not run
+bool Chip8::returnFromSubroutine() 
+{
+    if (SP == 0 || SP > STACK_DEPTH)
+    {
+        printf("Stack underflow at address %04hX, program terminated\n", PC);
+        halt = HALT_STACK;
+        return false;
+    }
+#ifdef CHIP8_PROFILE
+    if (profiler) profiler->ret();
+#endif
     PC = stack[SP];
     --SP;
+    return true;
 }
 
 void Chip8::jump(uint16_t addr) 
@@ -278,25 +922,140 @@ void Chip8::jump(uint16_t addr)
     PC -= 2; // keep program counter static after runCycle increment
 }
 
-void Chip8::call(uint16_t addr) 
+// true if every instruction from target up to the jump at jumpAddr is one idleLoopLength can follow;
+// decided once at decode, idleLoopLength checks memory again every time
+bool Chip8::pollingLoop(uint16_t jumpAddr, uint16_t target) const
+{
+    if (target > jumpAddr || jumpAddr - target > 2 * IDLE_MAX_BODY)
+    {
+        return false;
+    }
+    for (uint16_t pc = target; pc < jumpAddr; pc += 2)
+    {
+        uint8_t high = mem[pc];
+        uint8_t low = mem[(pc + 1) & ADDRESS_MASK];
+        bool polls = (high >> 4) == 0x3 || (high >> 4) == 0x4 || (high >> 4) == 0x6 ||
+            (((high >> 4) == 0x5 || (high >> 4) == 0x9) && !(low & 0xF)) ||
+            ((high >> 4) == 0xE && (low == 0x9E || low == 0xA1)) ||
+            ((high >> 4) == 0xF && low == 0x07);
+        if (!polls)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Instructions in one turn of the loop from target to the 1nnn at jumpAddr, jump included,
+// if a turn starting from the current state ends in that same state; 0 otherwise.
+// Only instructions that read DT, the keypad or constants are allowed, and neither
+// changes while runCycles runs, so such a loop repeats exactly until it returns.
+int Chip8::idleLoopLength(uint16_t jumpAddr, uint16_t target, uint16_t keypad) const
+{
+    uint8_t regs[16];
+    std::copy(V, V + 16, regs);
+
+    uint16_t pc = target;
+    int executed = 0;
+    while (pc != jumpAddr)
+    {
+        // leaving the loop, or a body longer than looked for
+        if (pc > jumpAddr || executed == IDLE_MAX_BODY)
+        {
+            return 0;
+        }
+        uint16_t opcode = ((uint16_t)mem[pc] << 8) + mem[(pc + 1) & ADDRESS_MASK];
+        uint8_t x = (opcode >> 8) & 0xF;
+        uint8_t y = (opcode >> 4) & 0xF;
+        uint8_t kk = opcode & 0xFF;
+        int skip = -1; // -1 for an instruction that is not a skip
+
+        switch (opcode >> 12)
+        {
+            case (0x3):
+                skip = regs[x] == kk;
+                break;
+            case (0x4):
+                skip = regs[x] != kk;
+                break;
+            case (0x5):
+            case (0x9):
+                if (opcode & 0xF)
+                {
+                    return 0;
+                }
+                skip = (regs[x] == regs[y]) == ((opcode >> 12) == 0x5);
+                break;
+            case (0x6):
+                regs[x] = kk;
+                break;
+            case (0xE):
+                if (kk != 0x9E && kk != 0xA1)
+                {
+                    return 0;
+                }
+                skip = ((keypad >> (regs[x] & 0xF)) & 1) == (kk == 0x9E);
+                break;
+            case (0xF):
+                if (kk != 0x07)
+                {
+                    return 0;
+                }
+                regs[x] = DT;
+                break;
+            default:
+                return 0;
+        }
+
+        // skipping F000 nnnn steps over four bytes, not worth following
+        if (skip == 1 && pc + 2 < jumpAddr && mem[pc + 2] == 0xF0 && mem[(pc + 3) & ADDRESS_MASK] == 0x00)
+        {
+            return 0;
+        }
+        pc += skip == 1 ? 4 : 2;
+        ++executed;
+    }
+
+    return std::equal(regs, regs + 16, V) ? executed + 1 : 0;
+}
+
+// halts the program with PC left on the faulting instruction, which does not run
+bool Chip8::call(uint16_t addr) 
 {
+    if (SP >= STACK_DEPTH)
+    {
+        printf("Stack overflow at address %04hX, program terminated\n", PC);
+        halt = HALT_STACK;
+        return false;
+    }
+#ifdef CHIP8_PROFILE
+    if (profiler) profiler->call(addr);
+#endif
     ++SP;
     stack[SP] = PC;
     PC = addr;
     PC -= 2; // keep program counter static after runCycle increment
+    return true;
+}
+
+// skips the next instruction, which is two words long if it is XO-CHIP's F000 nnnn
+void Chip8::skip()
+{
+    bool longLoad = mem[(PC + 2) & ADDRESS_MASK] == 0xF0 && mem[(PC + 3) & ADDRESS_MASK] == 0x00;
+    PC += longLoad ? 4 : 2;
 }
 
 void Chip8::skipEquals(uint8_t byte1, uint8_t byte2) 
 {
     if (byte1 == byte2) {
-        PC += 2;
+        skip();
     }
 }
 
 void Chip8::skipNotEquals(uint8_t byte1, uint8_t byte2) 
 {
     if (byte1 != byte2) {
-        PC += 2;
+        skip();
     }
 }
 
@@ -310,19 +1069,34 @@ void Chip8::add(uint8_t x, uint8_t byte)
     V[x] += byte;
 }
 
+template <QuirkProfile P>
 void Chip8::orOp(uint8_t x, uint8_t y) 
 {
     V[x] = (V[x] | V[y]);
+    if constexpr (QUIRK_PROFILES[P].logicResetsVF)
+    {
+        V[0xf] = 0;
+    }
 }
 
+template <QuirkProfile P>
 void Chip8::andOp(uint8_t x, uint8_t y) 
 {
     V[x] = (V[x] & V[y]);
+    if constexpr (QUIRK_PROFILES[P].logicResetsVF)
+    {
+        V[0xf] = 0;
+    }
 }
 
+template <QuirkProfile P>
 void Chip8::xorOp(uint8_t x, uint8_t y) 
 {
     V[x] = (V[x] ^ V[y]);
+    if constexpr (QUIRK_PROFILES[P].logicResetsVF)
+    {
+        V[0xf] = 0;
+    }
 }
 
 void Chip8::addCarry(uint8_t x, uint8_t y)
@@ -349,8 +1123,13 @@ void Chip8::subtract(uint8_t x, uint8_t y)
     V[x] = V[x] - V[y];
 }
 
-void Chip8::shiftRight(uint8_t x) 
+template <QuirkProfile P>
+void Chip8::shiftRight(uint8_t x, uint8_t y) 
 {
+    if constexpr (QUIRK_PROFILES[P].shiftUsesVy)
+    {
+        V[x] = V[y];
+    }
     V[0xf] = (1 & V[x]);
 
     V[x] = V[x] >> 1;
@@ -368,8 +1147,13 @@ void Chip8::subtractSwapped(uint8_t x, uint8_t y)
     V[x] = V[y] - V[x];
 }
 
-void Chip8::shiftLeft(uint8_t x) 
+template <QuirkProfile P>
+void Chip8::shiftLeft(uint8_t x, uint8_t y) 
 {
+    if constexpr (QUIRK_PROFILES[P].shiftUsesVy)
+    {
+        V[x] = V[y];
+    }
     V[0xf] = ((0b1000'0000 & V[x]) >> 7);
 
     V[x] = V[x] << 1;
@@ -380,58 +1164,192 @@ void Chip8::loadAddr(uint16_t addr)
     I = addr;
 }
 
+void Chip8::seedRandom(uint64_t seed)
+{
+    // splitmix64 spreads any seed, 0 included, over the whole state so xoshiro never starts all zero
+    for (auto i = 0; i < 4; i += 2)
+    {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        z ^= z >> 31;
+        rngState[i] = (uint32_t)z;
+        rngState[i + 1] = (uint32_t)(z >> 32);
+    }
+}
+
 void Chip8::random(uint8_t x, uint8_t byte) 
 {
-    uint8_t randInt = std::rand();
+    // xoshiro128**, the high byte of its output is as good as any
+    uint32_t* s = rngState;
+    uint32_t product = s[1] * 5;
+    uint32_t result = ((product << 7) | (product >> 25)) * 9;
+    uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 11) | (s[3] >> 21);
+
+    uint8_t randInt = result >> 24;
     V[x] = (randInt & byte);
 }
 
-void Chip8::drawByte(uint8_t byte, uint8_t x, uint8_t y) 
+// bits is one sprite row, left aligned; x and y are already on the screen.
+// Compiled separately for each resolution so low resolution rows stay single word operations.
+template <QuirkProfile P, bool Hires>
+void Chip8::drawRow(int plane, uint16_t bits, unsigned x, unsigned y) 
 {
-    for (auto i=0; i<8; ++i) {
-        // check left-most bit
-        if (byte & 0x80) 
+    uint64_t left;
+    uint64_t right = 0;
+
+    // place the sprite row at the left edge of a screen row, then move it into position
+    if constexpr (Hires)
+    {
+        unsigned __int128 sprite = (unsigned __int128)bits << (HIRES_WIDTH - 16);
+        if constexpr (QUIRK_PROFILES[P].clipSprites)
         {
-            // set carry flag if a collision occurs
-            if (screen[(y*SCREEN_WIDTH) + ((x+i) % SCREEN_WIDTH)] == WHITE_PIXEL) 
-            {
-                V[0xf] = 1;
-                screen[(y*SCREEN_WIDTH) + ((x+i) % SCREEN_WIDTH)] = BLACK_PIXEL;
-            }
-            else
-            {
-                screen[(y*SCREEN_WIDTH) + ((x+i) % SCREEN_WIDTH)] = WHITE_PIXEL;
-            }
+            // pixels shifted past the right edge fall off
+            sprite >>= x;
+        }
+        else
+        {
+            // rotate so it wraps horizontally
+            sprite = (sprite >> x) | (sprite << ((HIRES_WIDTH - x) % HIRES_WIDTH));
         }
-        byte = byte << 1;
+        left = sprite >> 64;
+        right = (uint64_t)sprite;
+    }
+    else
+    {
+        left = (uint64_t)bits << (LORES_WIDTH - 16);
+        if constexpr (QUIRK_PROFILES[P].clipSprites)
+        {
+            left >>= x;
+        }
+        else
+        {
+            left = (left >> x) | (left << ((LORES_WIDTH - x) % LORES_WIDTH));
+        }
+    }
+
+    uint64_t* row = screen[plane][y];
+
+    // set carry flag if a collision occurs
+    if ((row[0] & left) | (row[1] & right))
+    {
+        V[0xf] = 1;
+    }
+    row[0] ^= left;
+    row[1] ^= right;
+
+    if (left | right)
+    {
+        dirtyRows |= (uint64_t)1 << y;
     }
 }
 
+// draws rows [0, rows) of the sprite at addr into one plane, n being the Dxyn height with 0 for 16x16
+template <QuirkProfile P, bool Hires>
+void Chip8::drawSprite(int plane, uint16_t addr, uint8_t n, unsigned x, unsigned y, unsigned rows)
+{
+    const unsigned lastRow = (Hires ? HIRES_HEIGHT : LORES_HEIGHT) - 1;
+    if (n)
+    {
+        for (unsigned i = 0; i < rows; ++i)
+        {
+            drawRow<P, Hires>(plane, mem[(addr+i) & ADDRESS_MASK] << 8, x, (y + i) & lastRow);
+        }
+    }
+    else
+    {
+        for (unsigned i = 0; i < rows; ++i)
+        {
+            uint16_t bits = (mem[(addr+2*i) & ADDRESS_MASK] << 8) | mem[(addr+2*i+1) & ADDRESS_MASK];
+            drawRow<P, Hires>(plane, bits, x, (y + i) & lastRow);
+        }
+    }
+}
+
+template <QuirkProfile P>
 void Chip8::draw(uint8_t x, uint8_t y, uint8_t n) 
 {
+#ifdef CHIP8_PROFILE
+    ProfileTimer drawTimer(profiler ? &profiler->drawNanos : nullptr);
+#endif
+    // the sprite always starts on screen, both sizes are powers of two
+    unsigned rows = height();
+    unsigned left = V[x] & (width() - 1);
+    unsigned top = V[y] & (rows - 1);
+
     // carry flag set by default to 0 (no collision)
     V[0xf] = 0;
 
-    for (auto i=0; i<n; ++i) {
-        drawByte(mem[I+i], V[x], V[y] + i);
+    // Dxy0 draws a 16x16 sprite from two bytes per row
+    unsigned spriteRows = n ? n : 16;
+    if constexpr (QUIRK_PROFILES[P].clipSprites)
+    {
+        // rows below the bottom edge are dropped
+        if (spriteRows > rows - top)
+        {
+            spriteRows = rows - top;
+        }
+    }
+
+    // each selected plane draws its own sprite, the second plane's data following the first's
+    uint16_t addr = I;
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        if (!(planes & (1 << p)))
+        {
+            continue;
+        }
+        if (hires)
+        {
+            drawSprite<P, true>(p, addr, n, left, top, spriteRows);
+        }
+        else
+        {
+            drawSprite<P, false>(p, addr, n, left, top, spriteRows);
+        }
+        addr += n ? n : 32;
     }
+}
 
-    screenDrawn = true;
+void Chip8::renderScreen(uint32_t* pixels, int pitch, int firstRow, int rows) const
+{
+    int words = width() / 64;
+    for (auto y = firstRow; y < firstRow + rows; ++y)
+    {
+        uint32_t* line = reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(pixels) + (y - firstRow) * pitch);
+        for (auto w = 0; w < words; ++w)
+        {
+            uint64_t first = screen[0][y][w];
+            uint64_t second = screen[1][y][w];
+            for (auto x = 0; x < 64; ++x)
+            {
+                // leftmost pixel is the most significant bit
+                unsigned colour = ((first >> (63 - x)) & 1) | (((second >> (63 - x)) & 1) << 1);
+                line[w * 64 + x] = PALETTE[colour];
+            }
+        }
+    }
 }
 
-void Chip8::skipKeyPressed(uint8_t x, const uint8_t* keyboardState)
+void Chip8::skipKeyPressed(uint8_t x, uint16_t keypad)
 {
-    if (keyboardState[keyBindings[V[x]]])
+    if (keypad & (1 << (V[x] & 0xF)))
     {
-        PC += 2;
+        skip();
     }
 }
 
-void Chip8::skipNotPressed(uint8_t x, const uint8_t* keyboardState)
+void Chip8::skipNotPressed(uint8_t x, uint16_t keypad)
 {
-    if (!keyboardState[keyBindings[V[x]]])
+    if (!(keypad & (1 << (V[x] & 0xF))))
     {
-        PC += 2;
+        skip();
     }
 }
 
@@ -446,18 +1364,18 @@ void Chip8::loadFromDelayTimer(uint8_t x)
 // because of inconsistencies with simultaneous key input, I chose to just wait for the first key release,
 // meaning if a key is held down before Fx0A is reached, then another key is pressed and released while the original is held down,
 // the second key is registered. This may not be consistent with the original interpreter.
-void Chip8::waitKeyPress(uint8_t x, bool* keyUp)
+void Chip8::waitKeyPress(uint8_t x, uint16_t& keyUp)
 {
-    for (auto i = 0; i < 0x10; ++i)
+    for (auto i = 0; i < KEY_COUNT; ++i)
     {
-        if (keyUp[i])
+        if (keyUp & (1 << i))
         {
             V[x] = i;
             PC += 2;
             break;
         }
     }
-    std::fill(keyUp, keyUp + 16, 0);
+    keyUp = 0;
     PC -=2; // decrement program counter so after runCycle() the net change is 0 if not pressed, +2 if pressed.
 }
 
@@ -466,9 +1384,15 @@ void Chip8::setDelayTimer(uint8_t x)
     DT = V[x];
 }
 
-void Chip8::setSoundTimer(uint8_t x)
+void Chip8::setSoundTimer(uint8_t x, uint64_t cycle)
 {
+    bool wasOn = ST > 0;
     ST = V[x];
+    // reloading a running timer keeps the same tone going
+    if (wasOn != (ST > 0))
+    {
+        soundChanged(cycle);
+    }
 }
 
 void Chip8::addAddressRegister(uint8_t x)
@@ -481,25 +1405,117 @@ void Chip8::loadFont(uint8_t x)
     I = V[x] * 5; 
 }
 
+void Chip8::loadBigFont(uint8_t x)
+{
+    I = BIG_FONT_ADDRESS + (V[x] & 0xF) * 10;
+}
+
 void Chip8::loadBCD(uint8_t x)
 {
-    mem[I] = (V[x] / 100) % 10;
-    mem[I+1] = (V[x] / 10) % 10;
-    mem[I+2] = V[x] % 10;
+    storeByte(I, (V[x] / 100) % 10);
+    storeByte(I+1, (V[x] / 10) % 10);
+    storeByte(I+2, V[x] % 10);
 }
 
+template <QuirkProfile P>
 void Chip8::storeRegisters(uint8_t x)
 {
     for (auto i = 0; i <= x; ++i)
     {
-        mem[I+i] = V[i];
+        storeByte(I+i, V[i]);
     }
+    advanceI<P>(x);
 }
 
+template <QuirkProfile P>
 void Chip8::readRegisters(uint8_t x)
 {
     for (auto i = 0; i <= x; ++i)
     {
-        V[i] = mem[I+i];
+        V[i] = mem[(I+i) & ADDRESS_MASK];
     }
-}
\ No newline at end of file
+    advanceI<P>(x);
+}
+
+// Fx55/Fx65 on the original interpreters walked I through memory
+template <QuirkProfile P>
+void Chip8::advanceI(uint8_t x)
+{
+    if constexpr (QUIRK_PROFILES[P].memory == MEMORY_ADDS_X)
+    {
+        I += x;
+    }
+    else if constexpr (QUIRK_PROFILES[P].memory == MEMORY_ADDS_X_PLUS_1)
+    {
+        I += x + 1;
+    }
+}
+
+// RPL user flags survive in the host between programs on the HP-48, here they live as long as the Chip8
+void Chip8::storeFlags(uint8_t x)
+{
+    for (auto i = 0; i <= x; ++i)
+    {
+        rpl[i] = V[i];
+    }
+}
+
+void Chip8::readFlags(uint8_t x)
+{
+    for (auto i = 0; i <= x; ++i)
+    {
+        V[i] = rpl[i];
+    }
+}
+
+void Chip8::loadLong(uint16_t addr)
+{
+    I = addr;
+}
+
+// 5xy2/5xy3 walk from Vx to Vy in either direction and leave I where it was
+void Chip8::storeRange(uint8_t x, uint8_t y)
+{
+    int step = x <= y ? 1 : -1;
+    for (int i = 0, r = x; ; ++i, r += step)
+    {
+        storeByte(I + i, V[r]);
+        if (r == y)
+        {
+            break;
+        }
+    }
+}
+
+void Chip8::readRange(uint8_t x, uint8_t y)
+{
+    int step = x <= y ? 1 : -1;
+    for (int i = 0, r = x; ; ++i, r += step)
+    {
+        V[r] = mem[(I + i) & ADDRESS_MASK];
+        if (r == y)
+        {
+            break;
+        }
+    }
+}
+
+void Chip8::selectPlanes(uint8_t mask)
+{
+    planes = mask & ((1 << PLANE_COUNT) - 1);
+}
+
+void Chip8::loadAudioPattern(uint64_t cycle)
+{
+    for (auto i = 0; i < AUDIO_PATTERN_SIZE; ++i)
+    {
+        audioPattern[i] = mem[(I + i) & ADDRESS_MASK];
+    }
+    soundChanged(cycle);
+}
+
+void Chip8::setPitch(uint8_t x, uint64_t cycle)
+{
+    pitch = V[x];
+    soundChanged(cycle);
+}
@@ -1,45 +1,144 @@
 #ifndef CHIP8
 #define CHIP8
 
-#include <SDL2/SDL.h>
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
 #include <array>
 #include <string>
+#ifdef CHIP8_TRACE
+#include "trace.h"
+#endif
 
-constexpr int SCREEN_WIDTH = 64;
-constexpr int SCREEN_HEIGHT = 32;
-constexpr int MEM_SIZE = 4096;
+#ifdef CHIP8_PROFILE
+struct Profiler;
+#endif
+struct AudioStream;
+
+// the display is 64x32 until a SUPER-CHIP program switches it to 128x64
+constexpr int LORES_WIDTH = 64;
+constexpr int LORES_HEIGHT = 32;
+constexpr int HIRES_WIDTH = 128;
+constexpr int HIRES_HEIGHT = 64;
+constexpr int ROW_WORDS = HIRES_WIDTH / 64; // 64-bit words per screen row
+static_assert(HIRES_HEIGHT == 64, "dirtyRows keeps one bit per row in a 64-bit word");
+static_assert(!(LORES_WIDTH & (LORES_WIDTH - 1)) && !(LORES_HEIGHT & (LORES_HEIGHT - 1)), "sprite coordinates wrap with a mask");
+constexpr uint64_t ALL_ROWS = ~(uint64_t)0; // dirtyRows mask covering the whole screen in either mode
+constexpr int PLANE_COUNT = 2; // XO-CHIP bitplanes, a pixel's colour is one bit from each
+constexpr int MEM_SIZE = 65536; // XO-CHIP address space, CHIP-8 and SUPER-CHIP programs only use the first 4 KB
+constexpr int BASE_MEM_SIZE = 4096; // what CHIP-8 and SUPER-CHIP address, where Chip8::memUsed starts
 constexpr int PROGRAM_ADDRESS = 0x200;
+constexpr int ADDRESS_MASK = MEM_SIZE - 1;
 constexpr uint32_t WHITE_PIXEL = 0xFFFFFFFF;
 constexpr uint32_t BLACK_PIXEL = 0xFF000000;
+// ARGB for each combination of plane bits, plane 0 in bit 0; single plane programs only see the first two
+constexpr uint32_t PALETTE[1 << PLANE_COUNT] = { BLACK_PIXEL, WHITE_PIXEL, 0xFFAAAAAA, 0xFF555555 };
+
+constexpr int BIG_FONT_ADDRESS = 0x50; // SUPER-CHIP 8x10 digits follow the 4x5 ones
+
+constexpr int AUDIO_PATTERN_SIZE = 16; // XO-CHIP 1-bit sample buffer, played MSB first while ST is nonzero
+constexpr uint8_t DEFAULT_PITCH = 64; // plays the pattern at 4000 bits per second
+
+constexpr int KEY_COUNT = 16;
+constexpr int STACK_DEPTH = 15; // calls that can nest; SP indexes the newest return address and stack[0] stays unused
+constexpr int TIMER_FREQ = 60; // delay and sound timers count down at 60 hz
+constexpr int DEFAULT_CYCLES_PER_FRAME = 10; // instructions run per timer tick, 600 per second
+constexpr uint64_t DEFAULT_SEED = 1; // Cxkk seed when none is given
+constexpr int IDLE_MAX_BODY = 4; // longest loop body, jump excluded, checked for an idle wait
+
+// handler selected for a pre-decoded instruction, OP_DECODE marks an entry not yet decoded
+enum Op : uint8_t
+{
+    OP_DECODE, OP_INVALID, OP_SYS, OP_CLS, OP_RET, OP_JP, OP_CALL,
+    OP_SE_BYTE, OP_SNE_BYTE, OP_SE_REG, OP_LD_BYTE, OP_ADD_BYTE,
+    OP_LD_REG, OP_OR, OP_AND, OP_XOR, OP_ADD_REG, OP_SUB, OP_SHR,
+    OP_SUBN, OP_SHL, OP_SNE_REG, OP_LD_I, OP_JP_V0, OP_RND, OP_DRW,
+    OP_SKP, OP_SKNP, OP_LD_VX_DT, OP_LD_K, OP_LD_DT, OP_LD_ST,
+    OP_ADD_I, OP_LD_F, OP_LD_B, OP_LD_STORE, OP_LD_READ,
+    OP_SCD, OP_SCR, OP_SCL, OP_EXIT, OP_LOW, OP_HIGH,
+    OP_LD_HF, OP_LD_R, OP_LD_VX_R,
+    OP_SCU, OP_LD_LONG, OP_SAVE_RANGE, OP_LOAD_RANGE, OP_PLANE,
+    OP_AUDIO, OP_PITCH,
+    OP_JP_LOOP, // 1nnn back over a few instructions that only poll, checked for an idle wait when it runs
+    OP_COUNT
+};
+
+// Interpreters disagree on a handful of instructions. A profile picks one
+// behaviour for each; the interpreter is compiled once per profile so none of
+// them costs a runtime check.
+enum QuirkProfile : uint8_t
+{
+    QUIRKS_MODERN,     // what this interpreter has always done, and what most recent ROMs expect
+    QUIRKS_COSMAC_VIP, // the original 1977 interpreter
+    QUIRKS_CHIP48,     // HP-48 CHIP-48
+    QUIRKS_SUPERCHIP,  // SUPER-CHIP 1.1
+    QUIRKS_XOCHIP,     // XO-CHIP as defined by Octo
+    QUIRK_PROFILE_COUNT
+};
+
+// what Fx55/Fx65 leave in I
+enum MemoryQuirk : uint8_t
+{
+    MEMORY_KEEPS_I,
+    MEMORY_ADDS_X,
+    MEMORY_ADDS_X_PLUS_1
+};
+
+struct Quirks {
+    bool shiftUsesVy;   // 8xy6/8xyE copy Vy into Vx before shifting, rather than shifting Vx in place
+    MemoryQuirk memory;
+    bool jumpUsesVx;    // Bnnn jumps to nnn + Vx, x being the top nibble of nnn, rather than nnn + V0
+    bool logicResetsVF; // 8xy1/8xy2/8xy3 clear VF
+    bool clipSprites;   // sprite pixels past the right and bottom edges are dropped rather than wrapped around
+};
+
+constexpr Quirks QUIRK_PROFILES[QUIRK_PROFILE_COUNT] =
+{
+    { false, MEMORY_KEEPS_I, false, false, false },      // QUIRKS_MODERN
+    { true, MEMORY_ADDS_X_PLUS_1, false, true, true },   // QUIRKS_COSMAC_VIP
+    { false, MEMORY_ADDS_X, true, false, true },         // QUIRKS_CHIP48
+    { false, MEMORY_KEEPS_I, true, false, true },        // QUIRKS_SUPERCHIP
+    { true, MEMORY_ADDS_X_PLUS_1, false, false, false }  // QUIRKS_XOCHIP
+};
+
+// command line names, indexed by profile
+const char* const QUIRK_PROFILE_NAMES[QUIRK_PROFILE_COUNT] = { "modern", "vip", "chip48", "schip", "xochip" };
+
+// false if name is not one of QUIRK_PROFILE_NAMES
+bool parseQuirkProfile(const char* name, QuirkProfile& profile);
+
+// FNV-1a, used to compare runs without keeping whole screens or states around
+// and to recognise ROMs by their contents
+uint64_t hashBytes(const void* data, size_t length, uint64_t hash = 0xCBF29CE484222325);
 
-namespace Keypad 
+// why a program stopped, Chip8::runCycles does nothing once it has
+enum Halt : uint8_t
 {
-    constexpr int KEY_1 = SDL_SCANCODE_1;
-    constexpr int KEY_2 = SDL_SCANCODE_2;
-    constexpr int KEY_3 = SDL_SCANCODE_3;
-    constexpr int KEY_C = SDL_SCANCODE_4;
-    constexpr int KEY_4 = SDL_SCANCODE_Q;
-    constexpr int KEY_5 = SDL_SCANCODE_W;
-    constexpr int KEY_6 = SDL_SCANCODE_E;
-    constexpr int KEY_D = SDL_SCANCODE_R;
-    constexpr int KEY_7 = SDL_SCANCODE_A;
-    constexpr int KEY_8 = SDL_SCANCODE_S;
-    constexpr int KEY_9 = SDL_SCANCODE_D;
-    constexpr int KEY_E = SDL_SCANCODE_F;
-    constexpr int KEY_A = SDL_SCANCODE_Z;
-    constexpr int KEY_0 = SDL_SCANCODE_X;
-    constexpr int KEY_B = SDL_SCANCODE_C;
-    constexpr int KEY_F = SDL_SCANCODE_V;
-}
+    HALT_NONE,
+    HALT_EXIT,    // 00FD
+    HALT_INVALID, // an opcode no supported interpreter defines
+    HALT_STACK    // a call with the stack full or a return with it empty
+};
+
+struct Instruction {
+    uint8_t op;   // Op handler
+    uint8_t x;    // second nibble
+    uint8_t y;    // third nibble
+    uint8_t n;    // lowest nibble
+    uint8_t nn;   // lowest byte
+    uint16_t nnn; // lowest 12 bits
+};
 
 struct Chip8 {
     Chip8();
 
     uint8_t mem[MEM_SIZE]; // Chip-8 memory
-    uint32_t screen[SCREEN_WIDTH * SCREEN_HEIGHT]; // screen buffer
+    Instruction decoded[MEM_SIZE]; // instruction cache, one entry per address of mem
+    // screen buffer, one bit per pixel and plane with the leftmost pixel in the top bit of a row's first word.
+    // In low resolution only the first word of the first 32 rows is used.
+    uint64_t screen[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+    uint8_t planes; // bitmask of the planes drawing, clearing and scrolling act on, Fn01
+    bool hires; // 128x64 mode
     uint8_t V[16]; // general purpose registers
     uint16_t stack[16]; // stack stores return addresses for subroutines
     uint16_t I; // 16 bit register, used for storing memory addresses
@@ -47,45 +146,109 @@ struct Chip8 {
     uint8_t ST; // sound timer
     uint16_t PC; // program counter
     uint8_t SP; // stack pointer
+    uint32_t rngState[4]; // Cxkk xoshiro128** state, owned by this instance so parallel runs never share a sequence
+    uint8_t rpl[16]; // SUPER-CHIP RPL user flags, Fx75/Fx85
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE]; // F002
+    uint8_t pitch; // Fx3A, the pattern plays at 4000 * 2 ^ ((pitch - 64) / 48) bits per second
+    Halt halt;
+    uint64_t cycleCount; // instructions executed since construction
+    uint64_t idleCycles; // the part of cycleCount fast-forwarded through idle loops instead of interpreted
+    uint32_t codeVersion; // bumped whenever decoded code is overwritten
+    QuirkProfile quirks; // chosen when the ROM is loaded
+    bool fastForward; // count idle loops and Fx0A waits rather than run them; set before loading, the decode cache depends on it
+    uint32_t memUsed; // mem is all zero from here up; BASE_MEM_SIZE until a load or store goes past it, then MEM_SIZE
+
+    uint64_t dirtyRows; // bit n set if screen row n changed since the frontend last presented it
+
+#ifdef CHIP8_TRACE
+    TraceRing* trace; // every interpreted instruction is pushed here when set
+#endif
+#ifdef CHIP8_PROFILE
+    Profiler* profiler; // counts every interpreted instruction, call and return when set
+#endif
+    AudioStream* sound; // told about every change to the buzzer when set
+
+    bool loadFile(std::string filename, QuirkProfile profile = QUIRKS_MODERN);
+    bool loadBytes(const uint8_t* data, size_t length, QuirkProfile profile = QUIRKS_MODERN);
+    void resetCode();
+    void seedRandom(uint64_t seed); // same seed, same Cxkk sequence, on any thread or host
+
+    int width() const { return hires ? HIRES_WIDTH : LORES_WIDTH; }
+    int height() const { return hires ? HIRES_HEIGHT : LORES_HEIGHT; }
 
-    bool screenDrawn;
+    uint64_t hashScreen() const;
+    uint64_t hashState() const; // architectural state, the decode cache and dirty rows are left out
+    // the same as assigning from, but memory is only compared up to what either has used and goes through
+    // storeByte, so copying a 4 KB program costs a few KB rather than the whole address space and decode cache
+    void copyState(const Chip8& from);
 
-    bool loadFile(std::string filename);
+    // keypad is a bitmask of held keys (bit n = key n), keyUp a bitmask of keys released since the last Fx0A
+    void runCycle(uint16_t keypad, uint16_t& keyUp);
+    void runCycles(int cycles, uint16_t keypad, uint16_t& keyUp);
+    template <QuirkProfile P> void runCyclesAs(int cycles, uint16_t keypad, uint16_t& keyUp);
+    void runFrame(int cycles, uint16_t keypad, uint16_t& keyUp); // runCycles then one timer tick
+    void tickTimers();
+    void soundChanged(uint64_t cycle); // call after changing ST, the pattern or the pitch from outside
+    void invalidOpcode(uint16_t opcode); // reports the opcode and halts the program
 
-    void runCycle(const uint8_t* keyboardState, bool* keyUp);
-    void invalidOpcode(uint16_t opcode);
+    void decode(uint16_t addr);
+    void invalidateCode(uint16_t addr);
+    void storeByte(uint16_t addr, uint8_t byte);
+    void storeBytes(const uint8_t* bytes, uint32_t length); // bytes over mem from address 0, storing only the ones that differ
 
     void clearScreen();
-    void returnFromSubroutine();
+    bool returnFromSubroutine(); // false, with the program halted, if there is nothing to return to
     void jump(uint16_t addr);
-    void call(uint16_t addr);
+    bool pollingLoop(uint16_t jumpAddr, uint16_t target) const;
+    int idleLoopLength(uint16_t jumpAddr, uint16_t target, uint16_t keypad) const;
+    bool call(uint16_t addr); // false, with the program halted, if the stack is full
+    void skip();
     void skipEquals(uint8_t byte1, uint8_t byte2);
     void skipNotEquals(uint8_t byte1, uint8_t byte2);
     void loadRegister(uint8_t x, uint8_t byte);
     void add(uint8_t x, uint8_t byte);
-    void orOp(uint8_t x, uint8_t y);
-    void andOp(uint8_t x, uint8_t y);
-    void xorOp(uint8_t x, uint8_t y);
+    template <QuirkProfile P> void orOp(uint8_t x, uint8_t y);
+    template <QuirkProfile P> void andOp(uint8_t x, uint8_t y);
+    template <QuirkProfile P> void xorOp(uint8_t x, uint8_t y);
     void addCarry(uint8_t x, uint8_t y);
     void subtract(uint8_t x, uint8_t y);
-    void shiftRight(uint8_t x);
+    template <QuirkProfile P> void shiftRight(uint8_t x, uint8_t y);
     void subtractSwapped(uint8_t x, uint8_t y);
-    void shiftLeft(uint8_t x);
+    template <QuirkProfile P> void shiftLeft(uint8_t x, uint8_t y);
     void loadAddr(uint16_t addr);
     void random(uint8_t x, uint8_t byte);
-    void drawByte(uint8_t byte, uint8_t x, uint8_t y);
-    void draw(uint8_t x, uint8_t y, uint8_t n);
-    void skipKeyPressed(uint8_t x, const uint8_t* keyboardState);
-    void skipNotPressed(uint8_t x, const uint8_t* keyboardState);
+    template <QuirkProfile P, bool Hires> void drawRow(int plane, uint16_t bits, unsigned x, unsigned y);
+    template <QuirkProfile P, bool Hires> void drawSprite(int plane, uint16_t addr, uint8_t n, unsigned x, unsigned y, unsigned rows);
+    template <QuirkProfile P> void draw(uint8_t x, uint8_t y, uint8_t n);
+    // expands rows [firstRow, firstRow + rows) of the screen to width() ARGB pixels each, lines pitch bytes apart
+    void renderScreen(uint32_t* pixels, int pitch, int firstRow, int rows) const;
+    void scrollDown(uint8_t n);
+    void scrollUp(uint8_t n);
+    void scrollRight();
+    void scrollLeft();
+    void exitProgram();
+    void setResolution(bool high);
+    void skipKeyPressed(uint8_t x, uint16_t keypad);
+    void skipNotPressed(uint8_t x, uint16_t keypad);
     void loadFromDelayTimer(uint8_t x);
-    void waitKeyPress(uint8_t x, bool* keyUp);
+    void waitKeyPress(uint8_t x, uint16_t& keyUp);
     void setDelayTimer(uint8_t x);
-    void setSoundTimer(uint8_t x);
+    void setSoundTimer(uint8_t x, uint64_t cycle);
     void addAddressRegister(uint8_t x);
     void loadFont(uint8_t x);
+    void loadBigFont(uint8_t x);
     void loadBCD(uint8_t x);
-    void storeRegisters(uint8_t x);
-    void readRegisters(uint8_t x);
+    template <QuirkProfile P> void storeRegisters(uint8_t x);
+    template <QuirkProfile P> void readRegisters(uint8_t x);
+    template <QuirkProfile P> void advanceI(uint8_t x);
+    void storeFlags(uint8_t x);
+    void readFlags(uint8_t x);
+    void loadLong(uint16_t addr);
+    void storeRange(uint8_t x, uint8_t y);
+    void readRange(uint8_t x, uint8_t y);
+    void selectPlanes(uint8_t mask);
+    void loadAudioPattern(uint64_t cycle);
+    void setPitch(uint8_t x, uint64_t cycle);
 };
 
 #endif
\ No newline at end of file
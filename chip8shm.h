@@ -0,0 +1,107 @@
+#ifndef CHIP8_SHM
+#define CHIP8_SHM
+
+/* Layout of the POSIX shared memory region chip8-serve publishes
+   observations in, and the few inline functions an agent needs to drive it.
+   Plain C (GCC or Clang, for the __atomic builtins) so an agent in C, or
+   anything that can map a file such as Python with mmap and ctypes, can use
+   it without linking against the emulator.
+
+   The agent asks for a step by filling in the request fields and then
+   bumping request; the server runs it and publishes the observation under a
+   seqlock: sequence is odd while it writes and even once it is done, so a
+   reader that sees the same even value before and after reading knows what
+   it read is whole. Only one request may be outstanding at a time. */
+
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+#define CHIP8_SHM_MAGIC 0x4D533843u /* "C8SM" in little-endian memory */
+#define CHIP8_SHM_VERSION 1u
+#define CHIP8_SHM_SPINS 64u /* polls a waiting agent makes before it starts yielding its core */
+
+/* what a request asks the server to do */
+enum Chip8ShmCommand
+{
+    CHIP8_SHM_STEP,  /* hold requestKeypad for requestFrames frames */
+    CHIP8_SHM_RESET, /* go back to the state the server started in */
+    CHIP8_SHM_QUIT   /* stop serving; the server answers it before it exits */
+};
+
+typedef struct Chip8Observation {
+    uint64_t step;   /* request this answers, 0 for the state the server started in */
+    uint64_t frame;  /* frames run since the start or the last reset */
+    uint64_t cycles; /* instructions run since then */
+    int64_t reward;  /* what the server's reward hook gave for the step, 0 if it has none */
+    /* one bit per pixel and plane, the leftmost pixel in the top bit of a row's first word;
+       in low resolution only the first word of the first 32 rows is used */
+    uint64_t screen[2][64][2];
+    uint16_t stack[16];
+    uint16_t I;
+    uint16_t PC;
+    uint16_t keypad; /* keys the step held */
+    uint8_t V[16];
+    uint8_t DT;
+    uint8_t ST;
+    uint8_t SP;
+    uint8_t hires;
+    uint8_t planes;
+    uint8_t halt;    /* nonzero once the program has stopped, steps then only tick the timers */
+} Chip8Observation;
+
+typedef struct Chip8Shm {
+    uint32_t magic;   /* written last when the server sets the region up */
+    uint32_t version;
+    uint32_t size;    /* sizeof(Chip8Shm) */
+    uint32_t cyclesPerFrame;
+
+    /* written by the agent: the fields first, then request one past its last value */
+    uint64_t request;
+    uint16_t requestKeypad; /* bit n held = key n */
+    uint16_t requestFrames;
+    uint32_t requestCommand;
+
+    /* written by the server */
+    uint64_t sequence; /* odd while observation is being written */
+    Chip8Observation observation;
+} Chip8Shm;
+
+/* copies the newest observation into out, 0 if the server was writing it and the read has to be tried again */
+static inline int chip8_shm_read(const Chip8Shm* shm, Chip8Observation* out)
+{
+    uint64_t before = __atomic_load_n(&shm->sequence, __ATOMIC_ACQUIRE);
+    if (before & 1)
+    {
+        return 0;
+    }
+    memcpy(out, &shm->observation, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED) == before;
+}
+
+/* sends a request and returns its number, the step field of the observation that answers it */
+static inline uint64_t chip8_shm_request(Chip8Shm* shm, uint32_t command, uint16_t keypad, uint16_t frames)
+{
+    uint64_t request = __atomic_load_n(&shm->request, __ATOMIC_RELAXED) + 1;
+    shm->requestKeypad = keypad;
+    shm->requestFrames = frames;
+    shm->requestCommand = command;
+    __atomic_store_n(&shm->request, request, __ATOMIC_RELEASE);
+    return request;
+}
+
+/* waits until the observation answering request is published and copies it into out */
+static inline void chip8_shm_wait(const Chip8Shm* shm, uint64_t request, Chip8Observation* out)
+{
+    for (unsigned spins = 0; !chip8_shm_read(shm, out) || out->step != request; ++spins)
+    {
+        /* a step is a few microseconds, so poll first; yielding then costs nothing when the core is not wanted */
+        if (spins >= CHIP8_SHM_SPINS)
+        {
+            sched_yield();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "framesink.h"
+
+namespace
+{
+    const char* const FORMAT_NAMES[FRAME_FORMAT_COUNT] = { "raw", "y4m" };
+
+    const char Y4M_HEADER[] = "YUV4MPEG2 W128 H64 F60:1 Ip A1:1 Cmono XCOLORRANGE=FULL\n";
+    const char Y4M_FRAME[] = "FRAME\n";
+
+    // grey level of a palette entry, full range
+    uint8_t luma(uint32_t argb)
+    {
+        uint32_t r = (argb >> 16) & 0xFF, g = (argb >> 8) & 0xFF, b = argb & 0xFF;
+        return (r * 77 + g * 150 + b * 29) >> 8;
+    }
+
+    // palette index of a pixel in capture coordinates
+    unsigned colourAt(const Chip8& chip, int x, int y)
+    {
+        if (!chip.hires)
+        {
+            x >>= 1;
+            y >>= 1;
+        }
+        int shift = 63 - (x & 63);
+        return ((chip.screen[0][y][x >> 6] >> shift) & 1) | (((chip.screen[1][y][x >> 6] >> shift) & 1) << 1);
+    }
+}
+
+static_assert(CAPTURE_WIDTH == 128 && CAPTURE_HEIGHT == 64, "Y4M_HEADER spells out the capture size");
+
+BufferedWriter::BufferedWriter(int fd): fd(fd), used(0), failed(false)
+{
+}
+
+BufferedWriter::~BufferedWriter()
+{
+    flush();
+}
+
+void BufferedWriter::write(const void* data, size_t length)
+{
+    if (used + length > WRITER_BUFFER_SIZE && !flush())
+    {
+        return;
+    }
+    if (length >= WRITER_BUFFER_SIZE)
+    {
+        // too big to be worth copying, goes straight out behind what was buffered
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        while (length && !failed)
+        {
+            ssize_t done = ::write(fd, bytes, length);
+            failed = done <= 0;
+            bytes += done > 0 ? done : 0;
+            length -= done > 0 ? done : 0;
+        }
+        return;
+    }
+    std::memcpy(buffer + used, data, length);
+    used += length;
+}
+
+bool BufferedWriter::flush()
+{
+    size_t sent = 0;
+    while (sent < used && !failed)
+    {
+        ssize_t done = ::write(fd, buffer + sent, used - sent);
+        failed = done <= 0;
+        sent += done > 0 ? done : 0;
+    }
+    used = 0;
+    return !failed;
+}
+
+FrameSink::FrameSink(int fd, FrameFormat format): out(fd), format(format), frames(0), changes(0), run(0), lastScreen{}, lastHires(false), image{}
+{
+    if (format == FRAME_Y4M)
+    {
+        out.write(Y4M_HEADER, sizeof(Y4M_HEADER) - 1);
+    }
+}
+
+FrameSink::~FrameSink()
+{
+    finish();
+}
+
+bool FrameSink::present(const Chip8& chip)
+{
+    bool changed = !frames || chip.hires != lastHires || std::memcmp(chip.screen, lastScreen, sizeof(lastScreen));
+    ++frames;
+
+    if (changed)
+    {
+        // the frames held so far are complete, write them before the image changes
+        writeRun();
+        std::memcpy(lastScreen, chip.screen, sizeof(lastScreen));
+        lastHires = chip.hires;
+        capture(chip);
+        ++changes;
+    }
+
+    ++run;
+    if (format == FRAME_Y4M)
+    {
+        // a video needs every frame, so Y4M never holds any back
+        writeRun();
+    }
+    return !out.failed;
+}
+
+bool FrameSink::finish()
+{
+    writeRun();
+    return out.flush();
+}
+
+void FrameSink::capture(const Chip8& chip)
+{
+    if (format == FRAME_RAW)
+    {
+        std::memset(image, 0, RAW_FRAME_BYTES);
+        for (auto y = 0; y < CAPTURE_HEIGHT; ++y)
+        {
+            for (auto x = 0; x < CAPTURE_WIDTH; ++x)
+            {
+                if (colourAt(chip, x, y))
+                {
+                    image[(y * CAPTURE_WIDTH + x) >> 3] |= 0x80 >> (x & 7);
+                }
+            }
+        }
+        return;
+    }
+
+    uint8_t grey[4];
+    for (auto i = 0; i < 4; ++i)
+    {
+        grey[i] = luma(PALETTE[i]);
+    }
+    for (auto y = 0; y < CAPTURE_HEIGHT; ++y)
+    {
+        for (auto x = 0; x < CAPTURE_WIDTH; ++x)
+        {
+            image[y * CAPTURE_WIDTH + x] = grey[colourAt(chip, x, y)];
+        }
+    }
+}
+
+void FrameSink::writeRun()
+{
+    if (!run)
+    {
+        return;
+    }
+    if (format == FRAME_RAW)
+    {
+        out.write(&run, sizeof(run));
+        out.write(image, RAW_FRAME_BYTES);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < run; ++i)
+        {
+            out.write(Y4M_FRAME, sizeof(Y4M_FRAME) - 1);
+            out.write(image, CAPTURE_WIDTH * CAPTURE_HEIGHT);
+        }
+    }
+    run = 0;
+}
+
+bool parseFrameFormat(const char* name, FrameFormat& format)
+{
+    for (auto i = 0; i < FRAME_FORMAT_COUNT; ++i)
+    {
+        if (!std::strcmp(name, FORMAT_NAMES[i]))
+        {
+            format = (FrameFormat)i;
+            return true;
+        }
+    }
+    return false;
+}
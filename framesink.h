@@ -0,0 +1,72 @@
+#ifndef CHIP8_FRAMESINK
+#define CHIP8_FRAMESINK
+
+#include <cstddef>
+#include <cstdint>
+#include "chip8.h"
+
+constexpr size_t WRITER_BUFFER_SIZE = 64 * 1024;
+
+// Collects small writes into a fixed buffer and hands them to a file
+// descriptor in large ones, retrying short writes so pipes work.
+struct BufferedWriter {
+    BufferedWriter(int fd);
+    ~BufferedWriter(); // flushes
+
+    int fd;
+    size_t used;
+    bool failed; // set by the first write error, everything after it is dropped
+    uint8_t buffer[WRITER_BUFFER_SIZE];
+
+    void write(const void* data, size_t length);
+    bool flush();
+};
+
+// Every captured frame has the high resolution size, low resolution frames
+// are doubled, so a stream keeps one size across 00FE/00FF.
+constexpr int CAPTURE_WIDTH = HIRES_WIDTH;
+constexpr int CAPTURE_HEIGHT = HIRES_HEIGHT;
+constexpr int RAW_FRAME_BYTES = CAPTURE_WIDTH * CAPTURE_HEIGHT / 8;
+
+enum FrameFormat : uint8_t
+{
+    // records of a uint32 frame count, little-endian, then the image as 1 bit per pixel,
+    // rows top to bottom, leftmost pixel in the top bit, set where any plane is lit;
+    // a record covers every identical frame in a row
+    FRAME_RAW,
+    // YUV4MPEG2, 60 fps grey levels of the frontend palette, ready for any encoder;
+    // a frame identical to the last is written again from the held bytes without converting it
+    FRAME_Y4M,
+    FRAME_FORMAT_COUNT
+};
+
+// Streams the frames a run presents to a file, pipe or stdout. Nothing is
+// allocated per frame: an unchanged screen is caught by comparing it with a
+// copy of the last one and only a changed one is converted.
+struct FrameSink {
+    FrameSink(int fd, FrameFormat format);
+    ~FrameSink(); // finishes
+
+    BufferedWriter out;
+    FrameFormat format;
+    uint64_t frames;  // presented so far
+    uint64_t changes; // frames that differed from the one before
+    uint32_t run;     // raw: identical frames not written yet
+
+    uint64_t lastScreen[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+    bool lastHires;
+    uint8_t image[CAPTURE_WIDTH * CAPTURE_HEIGHT]; // the last frame in the format's bytes, only RAW_FRAME_BYTES of it for raw
+
+    // call once per emulated frame, after the timers tick; false once the output fails
+    bool present(const Chip8& chip);
+    // writes any frames still held and flushes
+    bool finish();
+
+    void capture(const Chip8& chip);
+    void writeRun();
+};
+
+// false if name is not raw or y4m
+bool parseFrameFormat(const char* name, FrameFormat& format);
+
+#endif
@@ -0,0 +1,407 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "aot.h"
+#include "jit.h"
+#include "savestate.h"
+#include "record.h"
+#include "romlibrary.h"
+#include "audio.h"
+#include "framesink.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+
+using std::printf; using std::exit;
+
+constexpr int DEFAULT_CYCLES = 1000000;
+
+#ifdef CHIP8_TRACE
+TraceRing* traceRing = nullptr;
+const char* traceFile = nullptr;
+
+// runs however the process exits, including after an invalid opcode halts the program, which is when the trace matters most
+void dumpTrace()
+{
+    if (traceRing)
+    {
+        traceRing->dump(traceFile);
+    }
+}
+#endif
+
+#ifdef CHIP8_PROFILE
+Profiler* profiler = nullptr;
+Chip8* profiledChip = nullptr;
+const char* profileFile = nullptr;
+
+// like the trace, written however the run ends
+void dumpProfile()
+{
+    FILE* file = std::fopen(profileFile, "w");
+    if (!file)
+    {
+        printf("Could not open profile file %s\n", profileFile);
+        return;
+    }
+    profiler->dump(*profiledChip, file);
+    std::fclose(file);
+}
+#endif
+
+void usage()
+{
+    printf("usage: chip8-headless <rom> [-c cycles | -f frames] [-p cycles-per-frame] [-e interp|jit|lockstep|aot] [-m module] [-q modern|vip|chip48|schip|xochip] [-s seed] [-t trace-file] [-P profile-file] [-r state-file] [-w state-file] [-l rom-library] [-a audio-file] [-o frame-file|- [-F y4m|raw]]\n");
+    printf("       -o streams every frame to a file, pipe or stdout, whose output then goes to stderr\n");
+    printf("       -e aot runs native code from the -m module chip8-aot compiled for the ROM, make rom.so builds one\n");
+    printf("       -a writes the buzzer as raw signed 16 bit mono samples at %d hz\n", AUDIO_SAMPLE_RATE);
+    printf("       chip8-headless <rom> -replay input-file\n");
+    exit(1);
+}
+
+// Runs a ROM without a window or any pacing, as fast as the host allows,
+// then reports how many instructions were executed per second.
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+
+    const char* romFile = argv[1];
+    long long cycles = DEFAULT_CYCLES;
+    long long frames = 0;
+    int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    const char* engine = "interp";
+    const char* moduleFile = nullptr;
+    const char* traceArg = nullptr;
+    const char* profileArg = nullptr;
+    const char* restoreFile = nullptr;
+    const char* saveFile = nullptr;
+    const char* replayFile = nullptr;
+    const char* libraryDir = nullptr;
+    const char* audioFile = nullptr;
+    const char* frameFile = nullptr;
+    FrameFormat frameFormat = FRAME_Y4M;
+    uint64_t seed = DEFAULT_SEED;
+    QuirkProfile quirks = QUIRKS_MODERN;
+    bool cyclesPerFrameSet = false;
+    bool quirksSet = false;
+
+    for (auto i = 2; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            usage();
+        }
+        if (!std::strcmp(argv[i], "-replay"))
+        {
+            replayFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-c"))
+        {
+            cycles = std::atoll(argv[++i]);
+            frames = 0;
+        }
+        else if (!std::strcmp(argv[i], "-f"))
+        {
+            frames = std::atoll(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-p"))
+        {
+            cyclesPerFrame = std::atoi(argv[++i]);
+            cyclesPerFrameSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-e"))
+        {
+            engine = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-m"))
+        {
+            moduleFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-q"))
+        {
+            if (!parseQuirkProfile(argv[++i], quirks))
+            {
+                usage();
+            }
+            quirksSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-l"))
+        {
+            libraryDir = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-s"))
+        {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if (!std::strcmp(argv[i], "-o"))
+        {
+            frameFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-F"))
+        {
+            if (!parseFrameFormat(argv[++i], frameFormat))
+            {
+                usage();
+            }
+        }
+        else if (!std::strcmp(argv[i], "-a"))
+        {
+            audioFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-t"))
+        {
+            traceArg = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-P"))
+        {
+            profileArg = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-r"))
+        {
+            restoreFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-w"))
+        {
+            saveFile = argv[++i];
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    // frames on stdout move every message to stderr, so nothing else lands in the stream
+    std::unique_ptr<FrameSink> frameSink;
+    if (frameFile)
+    {
+        // a reader that goes away fails the write with EPIPE, which is reported, rather than killing the process
+        std::signal(SIGPIPE, SIG_IGN);
+        int fd;
+        if (!std::strcmp(frameFile, "-"))
+        {
+            std::fflush(stdout);
+            fd = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        }
+        else
+        {
+            // a named pipe opens like a file, waiting for its reader
+            fd = open(frameFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd < 0)
+        {
+            printf("Could not open %s\n", frameFile);
+            exit(1);
+        }
+        frameSink.reset(new FrameSink(fd, frameFormat));
+    }
+
+    // with a library the ROM is a file name or hash in it, and its index entry fills in -p and -q
+    RomLibrary library;
+    const Rom* rom = nullptr;
+    if (libraryDir)
+    {
+        if (!library.open(libraryDir))
+        {
+            exit(1);
+        }
+        rom = library.find(romFile);
+        if (!rom)
+        {
+            printf("%s is not in the ROM library\n", romFile);
+            exit(1);
+        }
+        cyclesPerFrame = cyclesPerFrameSet ? cyclesPerFrame : rom->settings.cyclesPerFrame();
+        quirks = quirksSet ? quirks : rom->settings.quirks;
+    }
+
+    // the run loop counts down by cyclesPerFrame, anything less than 1 would never finish
+    if (cyclesPerFrame <= 0)
+    {
+        usage();
+    }
+
+    // in frame mode the timers tick once every cyclesPerFrame instructions, as they would on screen
+    if (frames > 0)
+    {
+        cycles = frames * cyclesPerFrame;
+    }
+
+    Chip8 chip = Chip8();
+    if (rom ? !chip.loadBytes(rom->data, rom->size, quirks) : !chip.loadFile(romFile, quirks))
+    {
+        exit(1);
+    }
+    chip.PC = PROGRAM_ADDRESS;
+    chip.seedRandom(seed);
+
+    // a recording carries its own seed, frame length and input, and checks the screen as it goes
+    if (replayFile)
+    {
+        uint64_t replayed;
+        auto start = std::chrono::steady_clock::now();
+        bool matched = replay(replayFile, chip, replayed);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("replayed %llu instructions in %.3f s, %llu frame hashes %s\n", (unsigned long long)chip.cycleCount, seconds,
+            (unsigned long long)replayed, matched ? "matched" : "did not match");
+        exit(matched ? 0 : 1);
+    }
+
+    // a save state replaces everything the ROM load set up
+    std::unique_ptr<Snapshot> snapshot(new Snapshot());
+    if (restoreFile && !(readSnapshot(restoreFile, *snapshot) && restoreState(chip, *snapshot)))
+    {
+        exit(1);
+    }
+
+    if (traceArg)
+    {
+#ifdef CHIP8_TRACE
+        traceRing = new TraceRing();
+        traceFile = traceArg;
+        chip.trace = traceRing;
+        std::atexit(dumpTrace);
+#else
+        printf("tracing is not compiled in, rebuild with make TRACE=1\n");
+        exit(1);
+#endif
+    }
+
+    if (profileArg)
+    {
+#ifdef CHIP8_PROFILE
+        profiler = new Profiler();
+        profiledChip = &chip;
+        profileFile = profileArg;
+        chip.profiler = profiler;
+        std::atexit(dumpProfile);
+#else
+        printf("profiling is not compiled in, rebuild with make PROFILE=1\n");
+        exit(1);
+#endif
+    }
+
+    bool useJit = !std::strcmp(engine, "jit");
+    bool lockstep = !std::strcmp(engine, "lockstep");
+    bool useAot = !std::strcmp(engine, "aot");
+    if ((!useJit && !lockstep && !useAot && std::strcmp(engine, "interp")) || (useAot && !moduleFile))
+    {
+        usage();
+    }
+
+    // audio is rendered a frame at a time right after the frame runs, the way the callback would hear it
+    std::unique_ptr<AudioStream> audio;
+    std::vector<int16_t> samples(AUDIO_SAMPLE_RATE / TIMER_FREQ);
+    FILE* audioOut = nullptr;
+    if (audioFile)
+    {
+        audioOut = std::fopen(audioFile, "wb");
+        if (!audioOut)
+        {
+            printf("Could not open %s\n", audioFile);
+            exit(1);
+        }
+        audio.reset(new AudioStream());
+        audio->configure(AUDIO_SAMPLE_RATE, cyclesPerFrame * TIMER_FREQ);
+        chip.sound = audio.get();
+        chip.soundChanged(chip.cycleCount);
+    }
+
+    // the JIT (and its lockstep reference) must be created once the ROM is in memory
+    Jit* jit = (useJit || lockstep) ? new Jit(chip, lockstep) : nullptr;
+    std::unique_ptr<Aot> aot;
+    if (useAot)
+    {
+        aot.reset(new Aot(chip));
+        if (!aot->load(moduleFile))
+        {
+            exit(1);
+        }
+    }
+
+    uint16_t keyUp = 0;
+    uint64_t startCycles = chip.cycleCount;
+
+    auto start = std::chrono::steady_clock::now();
+    for (long long remaining = cycles; remaining > 0 && !chip.halt; remaining -= cyclesPerFrame)
+    {
+        int batch = remaining < cyclesPerFrame ? remaining : cyclesPerFrame;
+        if (jit)
+        {
+            jit->runCycles(batch, 0, keyUp);
+        }
+        else if (aot)
+        {
+            aot->runCycles(batch, 0, keyUp);
+        }
+        else
+        {
+            chip.runCycles(batch, 0, keyUp);
+        }
+        if (batch == cyclesPerFrame)
+        {
+            chip.tickTimers();
+        }
+        if (frameSink && !frameSink->present(chip))
+        {
+            printf("Could not write frames to %s\n", frameFile);
+            exit(1);
+        }
+        if (audio)
+        {
+            audio->frameDone(chip.cycleCount);
+            audio->render(samples.data(), samples.size());
+            std::fwrite(samples.data(), sizeof(int16_t), samples.size(), audioOut);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // a program that exits or hits an invalid opcode ends the run early
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double executed = chip.cycleCount - startCycles;
+    printf("%.0f instructions in %.3f s (%.0f instructions/sec)\n", executed, seconds, executed / seconds);
+    if (chip.idleCycles)
+    {
+        printf("%llu of them fast-forwarded through idle loops\n", (unsigned long long)chip.idleCycles);
+    }
+    if (aot)
+    {
+        printf("%llu of them in compiled blocks\n", (unsigned long long)aot->compiledCycles);
+    }
+    if (chip.halt == HALT_EXIT)
+    {
+        printf("program exited at %04hX\n", chip.PC);
+    }
+
+    if (saveFile)
+    {
+        saveState(chip, *snapshot);
+        if (!writeSnapshot(saveFile, *snapshot))
+        {
+            exit(1);
+        }
+    }
+
+    if (audioOut)
+    {
+        std::fclose(audioOut);
+    }
+    if (frameSink)
+    {
+        frameSink->finish();
+        printf("%llu frames captured, %llu of them changed the screen\n", (unsigned long long)frameSink->frames, (unsigned long long)frameSink->changes);
+    }
+    delete jit;
+    return chip.halt == HALT_INVALID || chip.halt == HALT_STACK ? 1 : 0;
+}
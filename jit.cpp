@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "jit.h"
+
+// the longest translation of a single instruction plus the block epilogue
+constexpr size_t MAX_INSTRUCTION_CODE = 64;
+
+namespace
+{
+    // x86-64 emitter, every memory operand is [rdi + disp32] where rdi holds the Chip8 pointer
+    struct Emitter {
+        uint8_t* out;
+
+        void byte(uint8_t b) { *out++ = b; }
+        void word(uint16_t w) { std::memcpy(out, &w, 2); out += 2; }
+        void dword(uint32_t d) { std::memcpy(out, &d, 4); out += 4; }
+
+        // ModRM for [rdi + disp32] with reg as the register or opcode extension field
+        void mem(uint8_t reg, size_t disp)
+        {
+            byte(0x80 | (reg << 3) | 7);
+            dword(disp);
+        }
+
+        void loadAL(size_t disp) { byte(0x8A); mem(0, disp); }              // mov al, [m8]
+        void storeAL(size_t disp) { byte(0x88); mem(0, disp); }             // mov [m8], al
+        void storeCL(size_t disp) { byte(0x88); mem(1, disp); }             // mov [m8], cl
+        void storeImm(size_t disp, uint8_t b) { byte(0xC6); mem(0, disp); byte(b); } // mov byte [m8], imm8
+        void addImm(size_t disp, uint8_t b) { byte(0x80); mem(0, disp); byte(b); }   // add byte [m8], imm8
+        void orAL(size_t disp) { byte(0x08); mem(0, disp); }                // or [m8], al
+        void andAL(size_t disp) { byte(0x20); mem(0, disp); }               // and [m8], al
+        void xorAL(size_t disp) { byte(0x30); mem(0, disp); }               // xor [m8], al
+        void addToAL(size_t disp) { byte(0x02); mem(0, disp); }             // add al, [m8]
+        void subFromAL(size_t disp) { byte(0x2A); mem(0, disp); }           // sub al, [m8]
+        void cmpAL(size_t disp) { byte(0x3A); mem(0, disp); }               // cmp al, [m8]
+        void setcCL() { byte(0x0F); byte(0x92); byte(0xC1); }               // setc cl
+        void setaCL() { byte(0x0F); byte(0x97); byte(0xC1); }               // seta cl
+        void andALImm(uint8_t b) { byte(0x24); byte(b); }                   // and al, imm8
+        void shrALImm(uint8_t b) { byte(0xC0); byte(0xE8); byte(b); }       // shr al, imm8
+        void shrMem(size_t disp) { byte(0xD0); mem(5, disp); }              // shr byte [m8], 1
+        void shlMem(size_t disp) { byte(0xD0); mem(4, disp); }              // shl byte [m8], 1
+        void movzxEAX(size_t disp) { byte(0x0F); byte(0xB6); mem(0, disp); } // movzx eax, byte [m8]
+        void timesFiveEAX() { byte(0x8D); byte(0x04); byte(0x80); }         // lea eax, [rax + rax*4]
+        void storeAX(size_t disp) { byte(0x66); byte(0x89); mem(0, disp); } // mov [m16], ax
+        void addAX(size_t disp) { byte(0x66); byte(0x01); mem(0, disp); }   // add [m16], ax
+        void storeImm16(size_t disp, uint16_t w) { byte(0x66); byte(0xC7); mem(0, disp); word(w); } // mov word [m16], imm16
+        void cmpImm(size_t disp, uint8_t b) { byte(0x80); mem(7, disp); byte(b); }  // cmp byte [m8], imm8
+        void jumpIf(uint8_t cc, uint8_t rel) { byte(0x70 | cc); byte(rel); }      // jcc rel8
+        void ret() { byte(0xC3); }
+    };
+
+    constexpr uint8_t CC_E = 0x4;  // jcc condition codes
+    constexpr uint8_t CC_NE = 0x5;
+
+    size_t reg(uint8_t x)
+    {
+        return offsetof(Chip8, V) + x;
+    }
+
+    const size_t VF = offsetof(Chip8, V) + 0xF;
+    const size_t REG_I = offsetof(Chip8, I);
+    const size_t REG_DT = offsetof(Chip8, DT);
+    const size_t REG_PC = offsetof(Chip8, PC);
+
+    // emits the native form of one instruction, returning false if it has to be left to the interpreter.
+    // Each sequence reads and writes V in the same order as the matching Chip8 member so x or y being F behaves identically,
+    // and follows the same quirks.
+    bool emit(Emitter& e, const Instruction& ins, const Quirks& quirks)
+    {
+        switch (ins.op)
+        {
+            case (OP_SYS):
+                return true;
+            case (OP_LD_BYTE):
+                e.storeImm(reg(ins.x), ins.nn);
+                return true;
+            case (OP_ADD_BYTE):
+                e.addImm(reg(ins.x), ins.nn);
+                return true;
+            case (OP_LD_REG):
+                e.loadAL(reg(ins.y));
+                e.storeAL(reg(ins.x));
+                return true;
+            case (OP_OR):
+                e.loadAL(reg(ins.y));
+                e.orAL(reg(ins.x));
+                if (quirks.logicResetsVF)
+                {
+                    e.storeImm(VF, 0);
+                }
+                return true;
+            case (OP_AND):
+                e.loadAL(reg(ins.y));
+                e.andAL(reg(ins.x));
+                if (quirks.logicResetsVF)
+                {
+                    e.storeImm(VF, 0);
+                }
+                return true;
+            case (OP_XOR):
+                e.loadAL(reg(ins.y));
+                e.xorAL(reg(ins.x));
+                if (quirks.logicResetsVF)
+                {
+                    e.storeImm(VF, 0);
+                }
+                return true;
+            case (OP_ADD_REG):
+                e.loadAL(reg(ins.x));
+                e.addToAL(reg(ins.y));
+                e.setcCL();
+                e.storeCL(VF);
+                e.storeAL(reg(ins.x));
+                return true;
+            case (OP_SUB):
+                e.loadAL(reg(ins.x));
+                e.cmpAL(reg(ins.y));
+                e.setaCL();
+                e.storeCL(VF);
+                e.loadAL(reg(ins.x));
+                e.subFromAL(reg(ins.y));
+                e.storeAL(reg(ins.x));
+                return true;
+            case (OP_SUBN):
+                e.loadAL(reg(ins.y));
+                e.cmpAL(reg(ins.x));
+                e.setaCL();
+                e.storeCL(VF);
+                e.loadAL(reg(ins.y));
+                e.subFromAL(reg(ins.x));
+                e.storeAL(reg(ins.x));
+                return true;
+            case (OP_SHR):
+                if (quirks.shiftUsesVy)
+                {
+                    e.loadAL(reg(ins.y));
+                    e.storeAL(reg(ins.x));
+                }
+                e.loadAL(reg(ins.x));
+                e.andALImm(1);
+                e.storeAL(VF);
+                e.shrMem(reg(ins.x));
+                return true;
+            case (OP_SHL):
+                if (quirks.shiftUsesVy)
+                {
+                    e.loadAL(reg(ins.y));
+                    e.storeAL(reg(ins.x));
+                }
+                e.loadAL(reg(ins.x));
+                e.shrALImm(7);
+                e.storeAL(VF);
+                e.shlMem(reg(ins.x));
+                return true;
+            case (OP_LD_I):
+                e.storeImm16(REG_I, ins.nnn);
+                return true;
+            case (OP_ADD_I):
+                e.movzxEAX(reg(ins.x));
+                e.addAX(REG_I);
+                return true;
+            case (OP_LD_F):
+                e.movzxEAX(reg(ins.x));
+                e.timesFiveEAX();
+                e.storeAX(REG_I);
+                return true;
+            case (OP_LD_VX_DT):
+                e.loadAL(REG_DT);
+                e.storeAL(reg(ins.x));
+                return true;
+            case (OP_LD_DT):
+                e.loadAL(reg(ins.x));
+                e.storeAL(REG_DT);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // emits a 1nnn jump or a 3xkk/4xkk/5xy0/9xy0 skip at pc as the end of a block, storing the PC it leads to
+    // and returning, or returns false if ins is neither. Like Chip8::skip, a skip steps over two words when the
+    // next instruction is XO-CHIP's F000 nnnn; that instruction is decoded here, so a write to it flushes the block.
+    bool emitBranch(Emitter& e, Chip8& chip, uint16_t pc, const Instruction& ins)
+    {
+        if (ins.op == OP_JP)
+        {
+            e.storeImm16(REG_PC, ins.nnn);
+            e.ret();
+            return true;
+        }
+
+        uint8_t runsNext; // the condition under which the next instruction is not skipped
+        switch (ins.op)
+        {
+            case (OP_SE_BYTE):
+            case (OP_SNE_BYTE):
+                e.cmpImm(reg(ins.x), ins.nn);
+                runsNext = ins.op == OP_SE_BYTE ? CC_NE : CC_E;
+                break;
+            case (OP_SE_REG):
+            case (OP_SNE_REG):
+                e.loadAL(reg(ins.x));
+                e.cmpAL(reg(ins.y));
+                runsNext = ins.op == OP_SE_REG ? CC_NE : CC_E;
+                break;
+            default:
+                return false;
+        }
+
+        uint16_t next = pc + 2;
+        if (chip.decoded[next & ADDRESS_MASK].op == OP_DECODE)
+        {
+            chip.decode(next);
+        }
+        bool longLoad = chip.mem[next & ADDRESS_MASK] == 0xF0 && chip.mem[(next + 1) & ADDRESS_MASK] == 0x00;
+
+        e.jumpIf(runsNext, 0);
+        uint8_t* skipped = e.out;
+        e.storeImm16(REG_PC, next + (longLoad ? 4 : 2));
+        e.ret();
+        skipped[-1] = e.out - skipped;
+        e.storeImm16(REG_PC, next);
+        e.ret();
+        return true;
+    }
+}
+
+Jit::Jit(Chip8& chip, bool lockstep): chip(chip), reference(nullptr), lockstep(lockstep), blocks(nullptr), code(nullptr), codeUsed(0), version(chip.codeVersion)
+{
+    blocks = new Block[MEM_SIZE]();
+#if defined(__x86_64__)
+    // never writable and executable at once, translate opens the pages it emits into for writing only while it does
+    void* mapped = mmap(nullptr, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        printf("JIT code buffer could not be mapped, using the interpreter\n");
+    }
+    else
+    {
+        code = static_cast<uint8_t*>(mapped);
+    }
+#else
+    printf("JIT is only available on x86-64, using the interpreter\n");
+#endif
+    if (lockstep)
+    {
+        reference = new Chip8(chip);
+        reference->sound = nullptr;
+    }
+}
+
+Jit::~Jit()
+{
+    if (code)
+    {
+        munmap(code, JIT_CODE_SIZE);
+    }
+    delete[] blocks;
+    delete reference;
+}
+
+bool Jit::ok() const
+{
+    return code != nullptr;
+}
+
+void Jit::flush()
+{
+    std::fill(blocks, blocks + MEM_SIZE, Block{});
+    codeUsed = 0;
+    version = chip.codeVersion;
+}
+
+Jit::Block& Jit::translate(uint16_t addr)
+{
+    Block& block = blocks[addr & ADDRESS_MASK];
+
+    if (codeUsed + JIT_MAX_BLOCK * MAX_INSTRUCTION_CODE > JIT_CODE_SIZE)
+    {
+        flush();
+    }
+
+    block.translated = true;
+    block.length = 0;
+    block.fn = nullptr;
+
+    // the pages the longest block could reach, whole pages from the one holding codeUsed
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t* pages = code + (codeUsed & ~(pageSize - 1));
+    size_t pagesLength = (code + codeUsed + JIT_MAX_BLOCK * MAX_INSTRUCTION_CODE - pages + pageSize - 1) & ~(pageSize - 1);
+    if (mprotect(pages, pagesLength, PROT_READ | PROT_WRITE))
+    {
+        printf("JIT code buffer could not be made writable, interpreting %04hX\n", addr);
+        return block;
+    }
+
+    Emitter e{code + codeUsed};
+    int maxLength = lockstep ? 1 : JIT_MAX_BLOCK;
+    int length = 0;
+    bool branched = false;
+    uint16_t pc = addr;
+
+    while (length < maxLength)
+    {
+        // translated addresses go through the decode table so writes to them bump codeVersion
+        Instruction& ins = chip.decoded[pc & ADDRESS_MASK];
+        if (ins.op == OP_DECODE)
+        {
+            chip.decode(pc);
+        }
+        if (emit(e, ins, QUIRK_PROFILES[chip.quirks]))
+        {
+            ++length;
+            pc += 2;
+            continue;
+        }
+
+        // a jump or skip that ends the run is part of the block, which then leaves PC wherever it goes
+        branched = emitBranch(e, chip, pc, ins);
+        length += branched;
+        break;
+    }
+
+    if (length > 0)
+    {
+        if (!branched)
+        {
+            e.storeImm16(REG_PC, pc);
+            e.ret();
+        }
+        block.length = length;
+        block.fn = reinterpret_cast<BlockFn>(code + codeUsed);
+        codeUsed = e.out - code;
+    }
+
+    if (mprotect(pages, pagesLength, PROT_READ | PROT_EXEC))
+    {
+        printf("JIT code buffer could not be made executable\n");
+        exit(1);
+    }
+    return block;
+}
+
+// Runs translated blocks where possible and single interpreter steps for everything else.
+void Jit::runCycles(int cycles, uint16_t keypad, uint16_t& keyUp)
+{
+    if (!ok())
+    {
+        chip.runCycles(cycles, keypad, keyUp);
+        return;
+    }
+
+    if (lockstep)
+    {
+        // pick up timer ticks and anything else the frontend changed between calls
+        reference->copyState(chip);
+        reference->sound = nullptr;
+    }
+
+    while (cycles > 0 && !chip.halt)
+    {
+        if (chip.codeVersion != version)
+        {
+            flush();
+        }
+
+        Block* block = &blocks[chip.PC & ADDRESS_MASK];
+        if (!block->translated)
+        {
+            block = &translate(chip.PC);
+        }
+
+        if (block->fn && block->length <= cycles)
+        {
+            block->fn(&chip);
+            chip.cycleCount += block->length;
+            cycles -= block->length;
+            if (lockstep)
+            {
+                uint16_t referenceKeyUp = keyUp;
+                reference->runCycles(block->length, keypad, referenceKeyUp);
+                checkReference();
+            }
+        }
+        else
+        {
+            chip.runCycles(1, keypad, keyUp);
+            --cycles;
+            if (lockstep)
+            {
+                // only translated code is under test, copy what the interpreter did instead of running it twice
+                reference->copyState(chip);
+                reference->sound = nullptr;
+            }
+        }
+    }
+}
+
+void Jit::checkReference()
+{
+    const Chip8& ref = *reference;
+    if (std::memcmp(chip.V, ref.V, sizeof(chip.V)) == 0 && chip.I == ref.I && chip.PC == ref.PC &&
+        chip.SP == ref.SP && chip.DT == ref.DT && chip.ST == ref.ST &&
+        std::memcmp(chip.stack, ref.stack, sizeof(chip.stack)) == 0 &&
+        std::memcmp(chip.mem, ref.mem, std::max(chip.memUsed, ref.memUsed)) == 0)
+    {
+        return;
+    }
+
+    printf("JIT lockstep mismatch, PC %04hX (interpreter %04hX), I %04hX (interpreter %04hX)\n", chip.PC, ref.PC, chip.I, ref.I);
+    for (auto i = 0; i < 16; ++i)
+    {
+        if (chip.V[i] != ref.V[i])
+        {
+            printf("V%X %02hhX (interpreter %02hhX)\n", i, chip.V[i], ref.V[i]);
+        }
+    }
+    exit(1);
+}
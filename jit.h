@@ -0,0 +1,51 @@
+#ifndef CHIP8_JIT
+#define CHIP8_JIT
+
+#include <cstddef>
+#include <cstdint>
+#include "chip8.h"
+
+constexpr size_t JIT_CODE_SIZE = 4 * 1024 * 1024; // bytes of executable memory for translated blocks
+constexpr int JIT_MAX_BLOCK = 64; // most instructions translated into one block
+
+// Translates straight-line runs of Chip8 instructions into x86-64 code.
+//
+// A block covers the ALU, register load and delay timer instructions starting
+// at an address. When the first instruction it cannot run is a 1nnn jump or a
+// 3xkk, 4xkk, 5xy0 or 9xy0 skip, the block ends with it and sets PC to where
+// it goes, so a loop runs without leaving native code for its branch. Any
+// other call, draw, key wait, sound timer or memory instruction is left to the
+// interpreter, and the block sets PC to it.
+struct Jit {
+    // signature of a translated block, the argument is the Chip8 it runs on
+    typedef void (*BlockFn)(Chip8*);
+
+    struct Block {
+        BlockFn fn;      // nullptr if nothing could be translated
+        uint16_t length; // instructions covered, 0 if the first one is left to the interpreter
+        bool translated;
+    };
+
+    // lockstep runs every translated instruction a second time through the
+    // interpreter on a reference copy and stops at the first difference
+    Jit(Chip8& chip, bool lockstep = false);
+    ~Jit();
+
+    Chip8& chip;
+    Chip8* reference; // interpreter copy used by lockstep, nullptr otherwise
+    bool lockstep;
+
+    Block* blocks; // one entry per address of mem
+    uint8_t* code; // executable buffer, only writable while translate emits into it; nullptr if it could not be mapped
+    size_t codeUsed;
+    uint32_t version; // chip.codeVersion the blocks were translated from
+
+    bool ok() const;
+    void runCycles(int cycles, uint16_t keypad, uint16_t& keyUp);
+
+    void flush();
+    Block& translate(uint16_t addr);
+    void checkReference();
+};
+
+#endif
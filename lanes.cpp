@@ -0,0 +1,538 @@
+#include <cstdint>
+#include <cstring>
+#include "lanes.h"
+
+namespace
+{
+    // row[l] = value[l] in masked lanes, unchanged elsewhere; value and m are locals, so this vectorises
+    template <int N, typename T>
+    inline void select(T* row, const T* value, const T* m)
+    {
+        for (auto l = 0; l < N; ++l)
+        {
+            row[l] = (value[l] & m[l]) | (row[l] & ~m[l]);
+        }
+    }
+
+    // instructions every lane at a PC can run in one pass over the rows
+    bool together(uint8_t op)
+    {
+        switch (op)
+        {
+            case (OP_SYS):
+            case (OP_LD_BYTE):
+            case (OP_ADD_BYTE):
+            case (OP_LD_REG):
+            case (OP_OR):
+            case (OP_AND):
+            case (OP_XOR):
+            case (OP_ADD_REG):
+            case (OP_SUB):
+            case (OP_SHR):
+            case (OP_SUBN):
+            case (OP_SHL):
+            case (OP_LD_I):
+            case (OP_ADD_I):
+            case (OP_LD_F):
+            case (OP_LD_HF):
+            case (OP_LD_VX_DT):
+            case (OP_LD_DT):
+            case (OP_LD_READ):
+            case (OP_JP):
+            case (OP_JP_V0):
+            case (OP_CALL):
+            case (OP_RET):
+            case (OP_SE_BYTE):
+            case (OP_SNE_BYTE):
+            case (OP_SE_REG):
+            case (OP_SNE_REG):
+            case (OP_SKP):
+            case (OP_SKNP):
+                return true;
+            default:
+                // OP_JP_LOOP included: the interpreter fast-forwards idle waits, lanes would spin through them
+                return false;
+        }
+    }
+
+    // instructions that leave every lane that ran them at the same PC
+    bool straight(uint8_t op)
+    {
+        switch (op)
+        {
+            case (OP_JP_V0):
+            case (OP_RET):
+            case (OP_SE_BYTE):
+            case (OP_SNE_BYTE):
+            case (OP_SE_REG):
+            case (OP_SNE_REG):
+            case (OP_SKP):
+            case (OP_SKNP):
+                return false;
+            default:
+                return true;
+        }
+    }
+}
+
+template <int N>
+Lanes<N>::Lanes(): sameCode(MEM_SIZE, SameCode{ 0, 0 }), generation(1), executed(0), steps(0)
+{
+    for (auto l = 0; l < N; ++l)
+    {
+        chips[l].reset(new Chip8());
+        mem[l] = chips[l]->mem;
+        versions[l] = chips[l]->codeVersion;
+    }
+}
+
+template <int N>
+void Lanes<N>::load(int lane)
+{
+    const Chip8& chip = *chips[lane];
+    for (auto r = 0; r < 16; ++r)
+    {
+        V[r][lane] = chip.V[r];
+        stack[r][lane] = chip.stack[r];
+    }
+    I[lane] = chip.I;
+    PC[lane] = chip.PC;
+    DT[lane] = chip.DT;
+    SP[lane] = chip.SP;
+}
+
+template <int N>
+void Lanes<N>::store(int lane)
+{
+    Chip8& chip = *chips[lane];
+    for (auto r = 0; r < 16; ++r)
+    {
+        chip.V[r] = V[r][lane];
+        chip.stack[r] = stack[r][lane];
+    }
+    chip.I = I[lane];
+    chip.PC = PC[lane];
+    chip.DT = DT[lane];
+    chip.SP = SP[lane];
+    chip.cycleCount += ran[lane];
+    ran[lane] = 0;
+}
+
+// the lanes holding the same instruction at pc as the leader and following the same quirks
+template <int N>
+uint32_t Lanes<N>::compare(uint16_t pc, int leader)
+{
+    uint8_t high = mem[leader][pc];
+    uint8_t low = mem[leader][(pc + 1) & ADDRESS_MASK];
+    QuirkProfile quirks = chips[leader]->quirks;
+
+    uint32_t same = 0;
+    for (auto l = 0; l < N; ++l)
+    {
+        Chip8& chip = *chips[l];
+        if (mem[l][pc] == high && mem[l][(pc + 1) & ADDRESS_MASK] == low && chip.quirks == quirks)
+        {
+            // through the decode table, so a write to the instruction bumps the lane's codeVersion
+            if (chip.decoded[pc].op == OP_DECODE)
+            {
+                chip.decode(pc);
+            }
+            same |= 1u << l;
+        }
+    }
+    sameCode[pc] = SameCode{ same, generation };
+    return same;
+}
+
+// the lanes of group that can run the leader's instruction at pc with it
+template <int N>
+uint32_t Lanes<N>::gather(uint16_t pc, int leader, uint32_t group)
+{
+    const SameCode& known = sameCode[pc];
+    uint32_t same = known.generation == generation && ((known.lanes >> leader) & 1) ? known.lanes : compare(pc, leader);
+    group &= same;
+
+    // a call with the stack full or a return with it empty is left to the interpreter, which halts the lane there
+    uint8_t op = chips[leader]->decoded[pc].op;
+    if (op == OP_CALL || op == OP_RET)
+    {
+        for (auto l = 0; l < N; ++l)
+        {
+            bool faults = op == OP_CALL ? SP[l] >= STACK_DEPTH : SP[l] == 0 || SP[l] > STACK_DEPTH;
+            group &= ~((uint32_t)faults << l);
+        }
+    }
+    return group;
+}
+
+// runs up to count instructions of one lane through its interpreter
+template <int N>
+void Lanes<N>::interpret(int lane, int count, uint16_t keypad, uint16_t& keyUp)
+{
+    store(lane);
+    Chip8& chip = *chips[lane];
+
+    // waits only fast-forward when the interpreter is handed the rest of the lane's budget
+    const Instruction& ins = chip.decoded[chip.PC & ADDRESS_MASK];
+    bool waiting = ins.op == OP_LD_K || (ins.op == OP_JP_LOOP && chip.idleLoopLength(chip.PC, ins.nnn, keypad));
+    int step = waiting || count > left[lane] ? left[lane] : count;
+    chip.runCycles(step, keypad, keyUp);
+
+    left[lane] = chip.halt ? 0 : left[lane] - step;
+    load(lane);
+    if (chip.codeVersion != versions[lane])
+    {
+        versions[lane] = chip.codeVersion;
+        ++generation;
+    }
+}
+
+// Runs one instruction on every masked lane. Every statement of the
+// matching Chip8 member becomes a pass that copies the rows it reads into
+// locals, computes a row of results and selects them into the row it
+// writes, in the member's order, so x or y being F behaves identically.
+// Working on locals and selecting with masks rather than branching is what
+// lets the compiler vectorise each pass.
+template <int N>
+void Lanes<N>::execute(const Instruction& ins, uint16_t pc, const Quirks& quirks, const uint16_t* keypad)
+{
+    uint8_t m[N];
+    uint16_t wide[N]; // the mask widened for the 16 bit rows
+    uint8_t a[N], b[N], r[N];
+    uint16_t r16[N];
+    uint8_t x = ins.x, y = ins.y;
+    bool skip = false;
+
+    std::memcpy(m, mask, N);
+    for (auto l = 0; l < N; ++l) wide[l] = (int8_t)m[l];
+
+    switch (ins.op)
+    {
+        case (OP_SYS):
+            break;
+        case (OP_LD_BYTE):
+            std::memset(r, ins.nn, N);
+            select<N>(V[x], r, m);
+            break;
+        case (OP_ADD_BYTE):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r[l] = a[l] + ins.nn;
+            select<N>(V[x], r, m);
+            break;
+        case (OP_LD_REG):
+            std::memcpy(a, V[y], N);
+            select<N>(V[x], a, m);
+            break;
+        case (OP_OR):
+        case (OP_AND):
+        case (OP_XOR):
+            std::memcpy(a, V[x], N);
+            std::memcpy(b, V[y], N);
+            if (ins.op == OP_OR)
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] | b[l];
+            }
+            else if (ins.op == OP_AND)
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] & b[l];
+            }
+            else
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] ^ b[l];
+            }
+            select<N>(V[x], r, m);
+            if (quirks.logicResetsVF)
+            {
+                std::memset(r, 0, N);
+                select<N>(V[0xF], r, m);
+            }
+            break;
+        case (OP_ADD_REG):
+            std::memcpy(a, V[x], N);
+            std::memcpy(b, V[y], N);
+            for (auto l = 0; l < N; ++l) r[l] = a[l] + b[l];
+            for (auto l = 0; l < N; ++l) a[l] = r[l] < (a[l] | b[l]);
+            select<N>(V[0xF], a, m);
+            select<N>(V[x], r, m);
+            break;
+        case (OP_SUB):
+        case (OP_SUBN):
+        {
+            // SUB takes Vy from Vx, SUBN Vx from Vy
+            uint8_t from = ins.op == OP_SUB ? x : y;
+            uint8_t take = ins.op == OP_SUB ? y : x;
+            std::memcpy(a, V[from], N);
+            std::memcpy(b, V[take], N);
+            for (auto l = 0; l < N; ++l) r[l] = a[l] > b[l];
+            select<N>(V[0xF], r, m);
+            std::memcpy(a, V[from], N);
+            std::memcpy(b, V[take], N);
+            for (auto l = 0; l < N; ++l) r[l] = a[l] - b[l];
+            select<N>(V[x], r, m);
+            break;
+        }
+        case (OP_SHR):
+        case (OP_SHL):
+            if (quirks.shiftUsesVy)
+            {
+                std::memcpy(a, V[y], N);
+                select<N>(V[x], a, m);
+            }
+            std::memcpy(a, V[x], N);
+            if (ins.op == OP_SHR)
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] & 1;
+            }
+            else
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] >> 7;
+            }
+            select<N>(V[0xF], r, m);
+            std::memcpy(a, V[x], N);
+            if (ins.op == OP_SHR)
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] >> 1;
+            }
+            else
+            {
+                for (auto l = 0; l < N; ++l) r[l] = a[l] << 1;
+            }
+            select<N>(V[x], r, m);
+            break;
+        case (OP_LD_I):
+            for (auto l = 0; l < N; ++l) r16[l] = ins.nnn;
+            select<N>(I, r16, wide);
+            break;
+        case (OP_ADD_I):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r16[l] = I[l] + a[l];
+            select<N>(I, r16, wide);
+            break;
+        case (OP_LD_F):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r16[l] = a[l] * 5;
+            select<N>(I, r16, wide);
+            break;
+        case (OP_LD_HF):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r16[l] = BIG_FONT_ADDRESS + (a[l] & 0xF) * 10;
+            select<N>(I, r16, wide);
+            break;
+        case (OP_LD_VX_DT):
+            std::memcpy(a, DT, N);
+            select<N>(V[x], a, m);
+            break;
+        case (OP_LD_DT):
+            std::memcpy(a, V[x], N);
+            select<N>(DT, a, m);
+            break;
+        case (OP_LD_READ):
+            // a gather from every lane's own memory
+            for (auto l = 0; l < N; ++l)
+            {
+                if (m[l])
+                {
+                    for (auto i = 0; i <= x; ++i)
+                    {
+                        V[i][l] = mem[l][(I[l] + i) & ADDRESS_MASK];
+                    }
+                }
+            }
+            if (quirks.memory != MEMORY_KEEPS_I)
+            {
+                uint16_t advance = quirks.memory == MEMORY_ADDS_X ? x : x + 1;
+                for (auto l = 0; l < N; ++l) I[l] += wide[l] & advance;
+            }
+            break;
+        case (OP_JP):
+            for (auto l = 0; l < N; ++l) r16[l] = ins.nnn;
+            select<N>(PC, r16, wide);
+            return;
+        case (OP_JP_V0):
+            std::memcpy(a, V[quirks.jumpUsesVx ? x : 0], N);
+            for (auto l = 0; l < N; ++l) r16[l] = a[l] + ins.nnn;
+            select<N>(PC, r16, wide);
+            return;
+        case (OP_CALL):
+            for (auto l = 0; l < N; ++l)
+            {
+                if (m[l])
+                {
+                    ++SP[l];
+                    stack[SP[l]][l] = pc;
+                    PC[l] = ins.nnn;
+                }
+            }
+            return;
+        case (OP_RET):
+            for (auto l = 0; l < N; ++l)
+            {
+                if (m[l])
+                {
+                    PC[l] = stack[SP[l]][l] + 2;
+                    --SP[l];
+                }
+            }
+            return;
+        case (OP_SE_BYTE):
+        case (OP_SNE_BYTE):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r[l] = (a[l] == ins.nn) == (ins.op == OP_SE_BYTE);
+            skip = true;
+            break;
+        case (OP_SE_REG):
+        case (OP_SNE_REG):
+            std::memcpy(a, V[x], N);
+            std::memcpy(b, V[y], N);
+            for (auto l = 0; l < N; ++l) r[l] = (a[l] == b[l]) == (ins.op == OP_SE_REG);
+            skip = true;
+            break;
+        case (OP_SKP):
+        case (OP_SKNP):
+            std::memcpy(a, V[x], N);
+            for (auto l = 0; l < N; ++l) r[l] = ((keypad[l] >> (a[l] & 0xF)) & 1) == (ins.op == OP_SKP);
+            skip = true;
+            break;
+    }
+
+    if (skip)
+    {
+        // the instruction skipped over may differ between lanes, and is two words long if it is F000 nnnn
+        for (auto l = 0; l < N; ++l)
+        {
+            if (m[l] && r[l])
+            {
+                bool longLoad = mem[l][(pc + 2) & ADDRESS_MASK] == 0xF0 && mem[l][(pc + 3) & ADDRESS_MASK] == 0x00;
+                PC[l] += longLoad ? 4 : 2;
+            }
+        }
+    }
+    for (auto l = 0; l < N; ++l) PC[l] += wide[l] & 2;
+}
+
+template <int N>
+void Lanes<N>::runCycles(const int* cycles, const uint16_t* keypad, uint16_t* keyUp)
+{
+    for (auto l = 0; l < N; ++l)
+    {
+        load(l);
+        left[l] = chips[l]->halt ? 0 : cycles[l];
+        ran[l] = 0;
+        // the chips may have been loaded or written to since the last call
+        if (chips[l]->codeVersion != versions[l])
+        {
+            versions[l] = chips[l]->codeVersion;
+            ++generation;
+        }
+    }
+
+    for (;;)
+    {
+        // the lanes furthest back in the program go first, so lanes behind catch up rather than run apart
+        uint32_t lowest = MEM_SIZE;
+        for (auto l = 0; l < N; ++l)
+        {
+            // lanes that are done sort past every address
+            uint32_t at = PC[l] | ((uint32_t)(left[l] <= 0) << 16);
+            lowest = at < lowest ? at : lowest;
+        }
+        if (lowest == MEM_SIZE)
+        {
+            break;
+        }
+
+        uint16_t pc = lowest;
+        int budget = INT32_MAX; // instructions until the first lane in the group has run its share
+        for (auto l = 0; l < N; ++l)
+        {
+            mask[l] = -(uint8_t)((PC[l] == pc) & (left[l] > 0));
+            int32_t lane = mask[l] ? left[l] : INT32_MAX;
+            budget = lane < budget ? lane : budget;
+        }
+        uint32_t group = 0; // the mask as a bit per lane
+        for (auto l = 0; l < N; ++l)
+        {
+            group |= (uint32_t)(mask[l] & 1) << l;
+        }
+        int leader = __builtin_ctz(group);
+
+        // a lane on its own has nothing to share, the interpreter runs it faster in stretches
+        if (!(group & (group - 1)))
+        {
+            interpret(leader, LANE_SOLO_RUN, keypad[leader], keyUp[leader]);
+            continue;
+        }
+
+        // charges the lanes in the group for the instructions it ran since the last call
+        int run = 0;
+        auto settle = [&]()
+        {
+            int count = 0;
+            for (auto l = 0; l < N; ++l)
+            {
+                int in = (mask[l] & 1) * run;
+                left[l] -= in;
+                ran[l] += in;
+                count += mask[l] & 1;
+            }
+            executed += (uint64_t)count * run;
+            budget -= run;
+            run = 0;
+        };
+
+        // straight-line code, jumps and calls leave every lane in the group at the same PC, so it keeps
+        // going until it reaches something it cannot run together, branches, or a lane's budget runs out
+        bool first = true;
+        while (run < budget)
+        {
+            Chip8& chip = *chips[leader];
+            if (chip.decoded[pc].op == OP_DECODE)
+            {
+                chip.decode(pc);
+            }
+            const Instruction& ins = chip.decoded[pc];
+            uint32_t joined = together(ins.op) ? gather(pc, leader, group) : 0;
+            if (!((joined >> leader) & 1))
+            {
+                break;
+            }
+            if (joined != group)
+            {
+                // lanes that drop out are charged for what they ran with the group so far
+                settle();
+                group = joined;
+                for (auto l = 0; l < N; ++l)
+                {
+                    mask[l] = -(uint8_t)((group >> l) & 1);
+                }
+            }
+
+            execute(ins, pc, QUIRK_PROFILES[chip.quirks], keypad);
+            ++run;
+            ++steps;
+            first = false;
+            if (!straight(ins.op))
+            {
+                break;
+            }
+            pc = PC[leader];
+        }
+        settle();
+
+        // every lane in the group is at an instruction that has to run alone, take it on each in turn
+        for (; first && group; group &= group - 1)
+        {
+            int l = __builtin_ctz(group);
+            interpret(l, 1, keypad[l], keyUp[l]);
+        }
+    }
+
+    for (auto l = 0; l < N; ++l)
+    {
+        store(l);
+    }
+}
+
+template struct Lanes<8>;
+template struct Lanes<16>;
+template struct Lanes<32>;
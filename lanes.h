@@ -0,0 +1,66 @@
+#ifndef CHIP8_LANES
+#define CHIP8_LANES
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+
+constexpr int LANE_SOLO_RUN = 32; // instructions a lane with no other at its PC runs through its interpreter in one go
+
+// Runs N instances of Chip8 together, one per lane, the way a GPU runs
+// threads. The register file is kept structure-of-arrays with the lane
+// index innermost, so an instruction that several lanes are about to run at
+// the same PC updates all of them in one pass over a row, which the
+// compiler turns into vector code (make AVX2=1 for 32 byte vectors). A
+// mask keeps lanes that are elsewhere out of the pass; they get their turn
+// when their PC comes up. The smallest PC always goes first, so lanes that
+// diverged at a branch tend to meet again at the next join.
+//
+// Memory, the screen and everything else stay in each lane's own Chip8.
+// Instructions that need them (draws, stores, Cxkk, key waits, ...) run on
+// that lane alone through its interpreter, with the registers copied over
+// and back, so every lane ends bit-exact with a Chip8 run on its own.
+template <int N>
+struct Lanes {
+    static_assert(N <= 32, "lane sets are kept in 32 bit masks");
+
+    // lanes known to hold the same instruction at an address, and to follow the same quirks
+    struct SameCode {
+        uint32_t lanes;
+        uint32_t generation; // valid while it matches Lanes::generation
+    };
+
+    Lanes();
+
+    std::unique_ptr<Chip8> chips[N]; // one per lane, load ROMs into them before running
+
+    // between runCycles calls the chips hold every lane's state, during a call these rows do
+    alignas(32) uint8_t V[16][N];
+    alignas(32) uint16_t stack[16][N];
+    alignas(32) uint16_t I[N];
+    alignas(32) uint16_t PC[N];
+    alignas(32) uint8_t DT[N];
+    alignas(32) uint8_t SP[N];
+    alignas(32) uint8_t mask[N];   // 0xFF in lanes taking part in the current instruction
+    alignas(32) int32_t left[N];   // instructions each lane still has to run this call
+    alignas(32) int32_t ran[N];    // instructions run together since the lane's cycleCount was last brought up to date
+    uint8_t* mem[N];               // each chip's memory
+    uint32_t versions[N];          // each chip's codeVersion when sameCode was last known to be right for it
+    std::vector<SameCode> sameCode; // one entry per address of mem
+    uint32_t generation;           // bumped whenever any lane's code may have changed, which drops every sameCode entry
+    uint64_t executed;             // instructions run on every lane together, summed over lanes
+    uint64_t steps;                // passes that ran them
+
+    // every lane runs cycles[lane] instructions, with its own keypad and keyUp as in Chip8::runCycles
+    void runCycles(const int* cycles, const uint16_t* keypad, uint16_t* keyUp);
+
+    void load(int lane);  // chip registers into the rows
+    void store(int lane); // rows into the chip
+    uint32_t gather(uint16_t pc, int leader, uint32_t group);
+    uint32_t compare(uint16_t pc, int leader);
+    void interpret(int lane, int count, uint16_t keypad, uint16_t& keyUp);
+    void execute(const Instruction& ins, uint16_t pc, const Quirks& quirks, const uint16_t* keypad);
+};
+
+#endif
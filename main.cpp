@@ -2,27 +2,249 @@
 #include <cstdlib>
 #include <cstdio>
 #include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <memory>
 #include "chip8.h"
+#include "savestate.h"
+#include "record.h"
+#include "romlibrary.h"
+#include "audio.h"
+#include "triplebuffer.h"
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
+#include <cstring>
 
 using std::printf; using std::exit;
 
-SDL_Window* window = NULL;
+namespace Keypad 
+{
+    constexpr int KEY_1 = SDL_SCANCODE_1;
+    constexpr int KEY_2 = SDL_SCANCODE_2;
+    constexpr int KEY_3 = SDL_SCANCODE_3;
+    constexpr int KEY_C = SDL_SCANCODE_4;
+    constexpr int KEY_4 = SDL_SCANCODE_Q;
+    constexpr int KEY_5 = SDL_SCANCODE_W;
+    constexpr int KEY_6 = SDL_SCANCODE_E;
+    constexpr int KEY_D = SDL_SCANCODE_R;
+    constexpr int KEY_7 = SDL_SCANCODE_A;
+    constexpr int KEY_8 = SDL_SCANCODE_S;
+    constexpr int KEY_9 = SDL_SCANCODE_D;
+    constexpr int KEY_E = SDL_SCANCODE_F;
+    constexpr int KEY_A = SDL_SCANCODE_Z;
+    constexpr int KEY_0 = SDL_SCANCODE_X;
+    constexpr int KEY_B = SDL_SCANCODE_C;
+    constexpr int KEY_F = SDL_SCANCODE_V;
+}
+
+constexpr int KEY_REWIND = SDL_SCANCODE_BACKSPACE; // held to run backwards one frame at a time
+constexpr int KEY_SAVE_STATE = SDL_SCANCODE_F5;
+constexpr int KEY_LOAD_STATE = SDL_SCANCODE_F9;
+const char* const QUICKSAVE_FILE = "quicksave.c8s";
+constexpr int KEY_DUMP_PROFILE = SDL_SCANCODE_F10; // prints the profile so far, with make PROFILE=1
+constexpr int KEY_TURBO = SDL_SCANCODE_TAB; // held to run as fast as the host allows
+constexpr int TITLE_INTERVAL_MS = 500; // how often the speed in the window title is measured
+
+const char* const DEFAULT_ROM = "tetris.ch8";
+
+// scancode bound to each chip8 key, indexed by key value; a ROM library entry can rebind them
+std::array<int, KEY_COUNT> keyBindings
+{
+    Keypad::KEY_0, Keypad::KEY_1, Keypad::KEY_2, Keypad::KEY_3,
+    Keypad::KEY_4, Keypad::KEY_5, Keypad::KEY_6, Keypad::KEY_7,
+    Keypad::KEY_8, Keypad::KEY_9, Keypad::KEY_A, Keypad::KEY_B,
+    Keypad::KEY_C, Keypad::KEY_D, Keypad::KEY_E, Keypad::KEY_F
+};
+
+// runs on SDL's audio thread, everything it needs arrives through the stream's lock-free queue
+void audioCallback(void* userdata, Uint8* stream, int length)
+{
+    static_cast<AudioStream*>(userdata)->render(reinterpret_cast<int16_t*>(stream), length / sizeof(int16_t));
+}
+
+// plays the buzzer through the default device; SDL_AUDIODRIVER=dummy or disk works without sound hardware.
+// Returns 0, and the emulator stays silent, if no device opens.
+SDL_AudioDeviceID openAudio(AudioStream& stream, double cyclesPerSecond)
+{
+    SDL_AudioSpec wanted = {};
+    wanted.freq = AUDIO_SAMPLE_RATE;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = AUDIO_BUFFER_SAMPLES;
+    wanted.callback = audioCallback;
+    wanted.userdata = &stream;
+
+    SDL_AudioSpec obtained;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!device)
+    {
+        printf("audio failed to initialize, %s\n", SDL_GetError());
+        return 0;
+    }
+    stream.configure(obtained.freq, cyclesPerSecond);
+    printf("audio on %s at %d hz, %d sample buffer\n", SDL_GetCurrentAudioDriver(), obtained.freq, obtained.samples);
+    SDL_PauseAudioDevice(device, 0);
+    return device;
+}
 
-SDL_Renderer* renderer = NULL;
+// packs the held chip8 keys into a bitmask for the core
+uint16_t readKeypad(const uint8_t* keyboardState)
+{
+    uint16_t keypad = 0;
+    for (auto i = 0; i < KEY_COUNT; ++i)
+    {
+        if (keyboardState[keyBindings[i]])
+        {
+            keypad |= (1 << i);
+        }
+    }
+    return keypad;
+}
 
-//Current display image
-SDL_Texture* texture = NULL;
+// calls visit(first, count) for every run of adjacent rows set in rows, below height
+template <typename Visit>
+void forEachRowRun(uint64_t rows, int height, Visit visit)
+{
+    for (auto y = 0; y < height; ++y)
+    {
+        if (!(rows & ((uint64_t)1 << y)))
+        {
+            continue;
+        }
+
+        int first = y;
+        while (y < height && (rows & ((uint64_t)1 << y)))
+        {
+            ++y;
+        }
+        visit(first, y - first);
+    }
+}
+
+using Clock = std::chrono::steady_clock;
+
+// a finished screen, handed from the emulation thread to the render thread
+struct Frame {
+    uint32_t pixels[HIRES_HEIGHT * HIRES_WIDTH]; // rows HIRES_WIDTH pixels apart, only width x height used
+    int width;
+    int height;
+    uint64_t dirtyRows; // rows that may differ from the last frame the render thread took, only these are uploaded
+    Clock::time_point inputTime; // when the keypad change this frame first shows happened, if hasInput
+    bool hasInput;
+};
+
+// everything the render thread tells the emulation thread, written by the render thread only
+struct SharedInput {
+    std::atomic<uint16_t> keypad;   // held keys
+    std::atomic<uint16_t> released; // keys released since the emulation thread last took them
+    std::atomic<bool> rewinding;
+    std::atomic<bool> turbo;
+    std::atomic<int64_t> inputNanos; // steady clock time of the last keypad change
+    std::atomic<uint32_t> commands;  // COMMAND_* bits, taken by the emulation thread at its next frame
+    std::atomic<bool> quit;
+};
+
+enum Command : uint32_t
+{
+    COMMAND_SAVE_STATE = 1,
+    COMMAND_LOAD_STATE = 2,
+    COMMAND_DUMP_PROFILE = 4
+};
+
+// input-to-photon latency, from a keypad change to the present of the first frame that differs after it
+struct LatencyStats {
+    uint64_t samples = 0;
+    double totalMs = 0;
+    double maxMs = 0;
+
+    void add(Clock::duration latency)
+    {
+        double ms = std::chrono::duration<double, std::milli>(latency).count();
+        ++samples;
+        totalMs += ms;
+        maxMs = ms > maxMs ? ms : maxMs;
+    }
+};
+
+// layout holds the host key character for each chip8 key, as in a ROM library index
+bool bindKeys(const char* layout)
+{
+    std::array<int, KEY_COUNT> bindings;
+    for (auto i = 0; i < KEY_COUNT; ++i)
+    {
+        bindings[i] = SDL_GetScancodeFromKey((SDL_Keycode)layout[i]);
+        if (bindings[i] == SDL_SCANCODE_UNKNOWN)
+        {
+            printf("No key for '%c' in key layout %s\n", layout[i], layout);
+            return false;
+        }
+    }
+    keyBindings = bindings;
+    return true;
+}
 
 int main(int argc, char* argv[])
 {
+    const char* romFile = DEFAULT_ROM;
+    const char* recordFile = nullptr;
+    const char* libraryDir = nullptr;
+    QuirkProfile quirks = QUIRKS_MODERN;
+    bool quirksSet = false;
+    uint64_t seed = DEFAULT_SEED;
+    int cyclesPerFrameArg = 0;
+    for (auto i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] != '-')
+        {
+            romFile = argv[i];
+        }
+        else if (!std::strcmp(argv[i], "-ipf") && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            cyclesPerFrameArg = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "-record") && i + 1 < argc)
+        {
+            recordFile = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-quirks") && i + 1 < argc && parseQuirkProfile(argv[i + 1], quirks))
+        {
+            ++i;
+            quirksSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if (!std::strcmp(argv[i], "-library") && i + 1 < argc)
+        {
+            libraryDir = argv[++i];
+        }
+        else
+        {
+            printf("usage: main [rom] [-ipf instructions-per-frame] [-record input-file] [-quirks modern|vip|chip48|schip|xochip] [-seed n] [-library rom-directory]\n");
+            printf("       rom defaults to %s and -ipf to %d, or what the library has for the ROM; frames run at %d hz\n", DEFAULT_ROM, DEFAULT_CYCLES_PER_FRAME, TIMER_FREQ);
+            printf("       hold Tab to fast-forward\n");
+            exit(1);
+        }
+    }
+
+    SDL_Window* window = NULL;
+
+    SDL_Renderer* renderer = NULL;
+
+    //Current display image
+    SDL_Texture* texture = NULL;
+
     #pragma region
-    if( SDL_Init( SDL_INIT_VIDEO ) < 0 )
+    if( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO ) < 0 )
     {
         printf( "SDL initialization failed, %s\n",  SDL_GetError() );
         exit(1);
     }
 
-    window = SDL_CreateWindow( "CHIP8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH * 16, SCREEN_HEIGHT * 16, 0 );
+    window = SDL_CreateWindow( "CHIP8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, HIRES_WIDTH * 8, HIRES_HEIGHT * 8, 0 );
     if( window == nullptr )
     {
         printf( "window failed to initialize, %s\n", SDL_GetError() );
@@ -36,145 +258,363 @@ int main(int argc, char* argv[])
         exit(1);
     }
 
-    texture = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT );
+    texture = SDL_CreateTexture( renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, HIRES_WIDTH, HIRES_HEIGHT );
     if( texture == nullptr )
     {
         printf( "texture failed to initialize, %s\n", SDL_GetError() );
         exit(1);
     }
+
+    // the emulation thread pushes this to wake the render thread, which otherwise sleeps until there is input
+    Uint32 wakeEvent = SDL_RegisterEvents(1);
+    if( wakeEvent == (Uint32)-1 )
+    {
+        printf( "could not register an event, %s\n", SDL_GetError() );
+        exit(1);
+    }
     #pragma endregion
 
     // Initializing Chip8
     Chip8 chip = Chip8();
 
-    chip.loadFile( "tetris.ch8" );
-    chip.PC = 0x200;
+    // instructions run back to back at the start of every 60 hz frame
+    int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
 
-    bool quit = false;
+    // a library entry carries the profile, speed and keys the ROM was tuned with
+    RomLibrary library;
+    const Rom* rom = nullptr;
+    if (libraryDir)
+    {
+        if (!library.open(libraryDir))
+        {
+            exit(1);
+        }
+        rom = library.find(romFile);
+        if (!rom)
+        {
+            printf("%s is not in the ROM library\n", romFile);
+            exit(1);
+        }
+        quirks = quirksSet ? quirks : rom->settings.quirks;
+        cyclesPerFrame = rom->settings.cyclesPerFrame();
+        if (!bindKeys(rom->settings.keyLayout))
+        {
+            exit(1);
+        }
+    }
+
+    cyclesPerFrame = cyclesPerFrameArg ? cyclesPerFrameArg : cyclesPerFrame;
+
+    if (rom ? !chip.loadBytes(rom->data, rom->size, quirks) : !chip.loadFile(romFile, quirks))
+    {
+        exit(1);
+    }
+    chip.PC = PROGRAM_ADDRESS;
+    chip.seedRandom(seed);
 
     // event handler
     SDL_Event e;
+    const uint8_t* keyboardState = SDL_GetKeyboardState(NULL);
 
-    // texture variables
-    int pitch;
-    uint32_t* pixels;
+    // a recording only stays replayable if nothing but keypad input changes the machine, so rewind and state loads are off
+    Recorder recorder;
+    if (recordFile && !recorder.open(recordFile, chip, cyclesPerFrame))
+    {
+        exit(1);
+    }
+    bool allowStateChanges = !recordFile;
 
-    // array for keyUp events to be used for Fx0A: wait for key press instruction
-    bool keyUp[0x10];
-    std::fill(keyUp, keyUp + 0x10, false);
-    const uint8_t* keyboardState = SDL_GetKeyboardState(NULL);
+    // every frame is recorded so holding KEY_REWIND can step back through the last few minutes
+    Rewind rewind;
+    std::unique_ptr<Snapshot> quicksave(new Snapshot());
 
-    // creating timing variables
-    uint32_t cycle_currentTime = SDL_GetTicks();
-    uint32_t cycle_lastTime = cycle_currentTime;
-    uint32_t cycle_deltaTime = 0;
+#ifdef CHIP8_PROFILE
+    std::unique_ptr<Profiler> profiler(new Profiler());
+    chip.profiler = profiler.get();
+#endif
 
-    uint32_t delay_currentTime = SDL_GetTicks();
-    uint32_t delay_lastTime = delay_currentTime;
-    uint32_t delay_deltaTime = 0;
+    std::unique_ptr<AudioStream> audio(new AudioStream());
+    SDL_AudioDeviceID audioDevice = openAudio(*audio, cyclesPerFrame * TIMER_FREQ);
+    if (audioDevice)
+    {
+        chip.sound = audio.get();
+        chip.soundChanged(chip.cycleCount);
+    }
 
-    constexpr int CYCLE_FREQ = 500; // placeholder value, will be customizable on launch
-    constexpr int DELAY_RATE = 50; // likely to be fixed at 60 hz, determines delay and sound timer frequency. 
-    constexpr int cycleTime = float(1000) / CYCLE_FREQ; // length of instruction execution in ms
-    constexpr int delayTime = float(1000) / DELAY_RATE; // length of emulation cycle
+    SharedInput input = {};
+    std::unique_ptr<TripleBuffer<Frame>> frames(new TripleBuffer<Frame>());
+    std::atomic<uint64_t> framesRun(0); // emulated frames, for the speed shown in the title
 
-    while( !quit )
+    // The emulation thread owns chip from here on. It keeps its own 60 hz
+    // schedule, so a stalled present or compositor never slows the timers,
+    // and publishes a frame whenever the screen changed. In turbo it runs
+    // frames back to back and only renders one when the last was published
+    // a display frame ago, so however fast it goes it renders no more than
+    // the screen can show and the frames in between are skipped.
+    std::thread emulation([&]()
     {
-        //Handle inputs
-        while( SDL_PollEvent( &e ) != 0 )
+        // bitmask of keyUp events to be used for Fx0A: wait for key press instruction
+        uint16_t keyUp = 0;
+        int64_t seenInput = 0;
+        bool inputPending = false;
+        Clock::time_point inputTime;
+
+        // frames are scheduled against absolute deadlines so sleep overshoot never accumulates into drift
+        constexpr auto frameTime = std::chrono::nanoseconds(1000000000 / TIMER_FREQ);
+        constexpr int MAX_FRAMES_BEHIND = 5; // after a longer stall, resume from now instead of running a burst of frames
+        Clock::time_point nextFrame = Clock::now();
+        Clock::time_point lastPublish = nextFrame;
+        Clock::time_point lastWake = nextFrame;
+        bool wasTurbo = false;
+
+        // A slot comes back to this thread holding whichever older frame was
+        // last in it, so each one keeps the rows it has missed since, and only
+        // those are rendered into it. unseenRows are the rows changed since the
+        // last frame the render thread is known to have taken.
+        uint64_t slotRows[3] = { ALL_ROWS, ALL_ROWS, ALL_ROWS };
+        uint64_t unseenRows = 0;
+
+        while (!input.quit.load(std::memory_order_relaxed))
         {
-            if( e.type == SDL_QUIT )
+            uint32_t commands = input.commands.exchange(0);
+            if (commands & COMMAND_SAVE_STATE)
+            {
+                saveState(chip, *quicksave);
+                if (!writeSnapshot(QUICKSAVE_FILE, *quicksave))
+                {
+                    printf("Quicksave failed\n");
+                }
+            }
+            if ((commands & COMMAND_LOAD_STATE) && allowStateChanges && readSnapshot(QUICKSAVE_FILE, *quicksave))
             {
-                quit = true;
+                restoreState(chip, *quicksave);
+                rewind.clear();
+                chip.soundChanged(chip.cycleCount);
             }
-            if( e.type == SDL_KEYUP )
+#ifdef CHIP8_PROFILE
+            if (commands & COMMAND_DUMP_PROFILE)
             {
-                switch (e.key.keysym.scancode)
+                profiler->dump(chip, stdout);
+            }
+#endif
+
+            int64_t inputNanos = input.inputNanos.load(std::memory_order_acquire);
+            if (inputNanos != seenInput)
+            {
+                // the oldest unanswered change is the one the player is waiting on
+                if (!inputPending)
                 {
-                    case (Keypad::KEY_0):
-                        keyUp[0x0] = true;
-                        break;
-                    case (Keypad::KEY_1):
-                        keyUp[0x1] = true;
-                        break;
-                    case (Keypad::KEY_2):
-                        keyUp[0x2] = true;
-                        break;
-                    case (Keypad::KEY_3):
-                        keyUp[0x3] = true;
-                        break;
-                    case (Keypad::KEY_4):
-                        keyUp[0x4] = true;
-                        break;
-                    case (Keypad::KEY_5):
-                        keyUp[0x5] = true;
-                        break;
-                    case (Keypad::KEY_6):
-                        keyUp[0x6] = true;
-                        break;
-                    case (Keypad::KEY_7):
-                        keyUp[0x7] = true;
-                        break;
-                    case (Keypad::KEY_8):
-                        keyUp[0x8] = true;
-                        break;
-                    case (Keypad::KEY_9):
-                        keyUp[0x9] = true;
-                        break;
-                    case (Keypad::KEY_A):
-                        keyUp[0xA] = true;
-                        break;
-                    case (Keypad::KEY_B):
-                        keyUp[0xB] = true;
-                        break;
-                    case (Keypad::KEY_C):
-                        keyUp[0xC] = true;
-                        break;
-                    case (Keypad::KEY_D):
-                        keyUp[0xD] = true;
-                        break;
-                    case (Keypad::KEY_E):
-                        keyUp[0xE] = true;
-                        break;
-                    case (Keypad::KEY_F):
-                        keyUp[0xF] = true;
-                        break;
+                    inputTime = Clock::time_point(Clock::duration(inputNanos));
+                    inputPending = true;
                 }
+                seenInput = inputNanos;
             }
+
+            // a turbo burst would overrun the audio queue, so the buzzer is muted and picked up again where it is afterwards
+            bool turbo = input.turbo.load(std::memory_order_relaxed);
+            if (turbo != wasTurbo && audioDevice)
+            {
+                if (turbo)
+                {
+                    audio->mute(chip, chip.cycleCount);
+                }
+                chip.sound = turbo ? nullptr : audio.get();
+                chip.soundChanged(chip.cycleCount);
+            }
+            wasTurbo = turbo;
+            Clock::time_point now = Clock::now();
+            bool present = !turbo || now - lastPublish >= frameTime;
+
+            if (input.rewinding.load(std::memory_order_relaxed) && allowStateChanges)
+            {
+                if (rewind.stepBack(chip))
+                {
+                    chip.soundChanged(chip.cycleCount);
+                }
+            }
+            else
+            {
+                uint16_t keypad = input.keypad.load(std::memory_order_relaxed);
+                // keys released since the last frame, added to keyUp when the frame runs
+                uint16_t released = input.released.exchange(0);
+                recorder.input(chip, keypad, released);
+                keyUp |= released;
+
+                // in turbo only the frames that are shown can be rewound to, pushing every one would cap the speed
+                if (allowStateChanges && present)
+                {
+                    rewind.push(chip);
+                }
+                chip.runFrame(cyclesPerFrame, keypad, keyUp);
+                recorder.frame(chip);
+                framesRun.fetch_add(1, std::memory_order_relaxed);
+            }
+            audio->frameDone(chip.cycleCount);
+
+            // skipped frames leave dirtyRows set, so the next one shown picks up their changes
+            if (chip.dirtyRows && present)
+            {
+                for (auto& rows : slotRows)
+                {
+                    rows |= chip.dirtyRows;
+                }
+                unseenRows |= chip.dirtyRows;
+
+                Frame& frame = frames->writeSlot();
+                frame.width = chip.width();
+                frame.height = chip.height();
+                forEachRowRun(slotRows[frames->back], frame.height, [&](int first, int count)
+                {
+                    chip.renderScreen(&frame.pixels[first * HIRES_WIDTH], HIRES_WIDTH * sizeof(uint32_t), first, count);
+                });
+                slotRows[frames->back] = 0;
+                frame.dirtyRows = unseenRows;
+                frame.inputTime = inputTime;
+                frame.hasInput = inputPending;
+                inputPending = false;
+                // once the frame before this one was taken, the render thread is only missing this one's rows
+                if (frames->publish())
+                {
+                    unseenRows = chip.dirtyRows;
+                }
+                chip.dirtyRows = 0;
+                lastPublish = now;
+            }
+
+            // the render thread presents on this, and without new frames it still wakes often enough to update the title's speed
+            if (lastPublish > lastWake || now - lastWake >= std::chrono::milliseconds(TITLE_INTERVAL_MS))
+            {
+                SDL_Event wake = {};
+                wake.type = wakeEvent;
+                SDL_PushEvent(&wake);
+                lastWake = now;
+            }
+
+            // sleep off the rest of the frame rather than polling; turbo never sleeps and the schedule restarts once it ends
+            nextFrame += frameTime;
+            now = Clock::now();
+            if (turbo)
+            {
+                nextFrame = now;
+            }
+            else if (now < nextFrame)
+            {
+                std::this_thread::sleep_until(nextFrame);
+            }
+            else if (now - nextFrame > frameTime * MAX_FRAMES_BEHIND)
+            {
+                nextFrame = now;
+            }
+        }
+    });
+
+    // this thread polls input and presents the newest frame; SDL wants both on the thread that created the window
+    LatencyStats latency;
+    bool quit = false;
+    Clock::time_point titleTime = Clock::now();
+    uint64_t titleFrames = 0;
+    char title[256] = "";
+    while( !quit )
+    {
+        // sleeps until there is input or the emulation thread pushes wakeEvent, then takes everything queued
+        if (SDL_WaitEvent(&e))
+        {
+            do
+            {
+                if( e.type == SDL_QUIT )
+                {
+                    quit = true;
+                }
+                if( e.type == SDL_KEYUP )
+                {
+                    for (auto i = 0; i < KEY_COUNT; ++i)
+                    {
+                        if (e.key.keysym.scancode == keyBindings[i])
+                        {
+                            input.released.fetch_or(1 << i);
+                        }
+                    }
+                }
+                if( e.type == SDL_KEYDOWN && !e.key.repeat )
+                {
+                    if (e.key.keysym.scancode == KEY_SAVE_STATE)
+                    {
+                        input.commands.fetch_or(COMMAND_SAVE_STATE);
+                    }
+                    else if (e.key.keysym.scancode == KEY_LOAD_STATE)
+                    {
+                        input.commands.fetch_or(COMMAND_LOAD_STATE);
+                    }
+                    else if (e.key.keysym.scancode == KEY_DUMP_PROFILE)
+                    {
+                        input.commands.fetch_or(COMMAND_DUMP_PROFILE);
+                    }
+                }
+            } while( SDL_PollEvent( &e ) != 0 );
         }
 
-        cycle_deltaTime = cycle_currentTime - cycle_lastTime;
-        if (cycle_deltaTime >= cycleTime)
+        uint16_t keypad = readKeypad(keyboardState);
+        if (keypad != input.keypad.load(std::memory_order_relaxed))
         {
-            cycle_deltaTime -= cycleTime;
-            chip.runCycle(keyboardState, keyUp);
-            cycle_lastTime = cycle_currentTime;
+            input.keypad.store(keypad, std::memory_order_relaxed);
+            input.inputNanos.store(Clock::now().time_since_epoch().count(), std::memory_order_release);
         }
+        input.rewinding.store(keyboardState[KEY_REWIND] != 0, std::memory_order_relaxed);
+        input.turbo.store(keyboardState[KEY_TURBO] != 0, std::memory_order_relaxed);
 
-        delay_deltaTime = delay_currentTime - delay_lastTime;
-        if (delay_deltaTime >= delayTime)
+        // the speed is emulated frames against the 60 a second real time would run, measured over the last interval
+        Clock::time_point now = Clock::now();
+        if (now - titleTime >= std::chrono::milliseconds(TITLE_INTERVAL_MS))
         {
-            delay_deltaTime -= delayTime;
-            if (chip.ST)
-                chip.ST--;
-            if (chip.DT)
-                chip.DT--;
-            delay_lastTime = delay_currentTime;
+            uint64_t run = framesRun.load(std::memory_order_relaxed);
+            double seconds = std::chrono::duration<double>(now - titleTime).count();
+            char text[sizeof(title)];
+            std::snprintf(text, sizeof(text), "CHIP8 - %s - %.1fx", romFile, (run - titleFrames) / (seconds * TIMER_FREQ));
+            if (std::strcmp(text, title))
+            {
+                std::strcpy(title, text);
+                SDL_SetWindowTitle(window, title);
+            }
+            titleTime = now;
+            titleFrames = run;
         }
 
-        if ( chip.screenDrawn ) {
-            SDL_LockTexture( texture, NULL, (void**)&pixels, &pitch );
-            memcpy( pixels, chip.screen, SCREEN_HEIGHT * pitch);
-            // memcpy( pixels, &chip.screen[0], 8192 );
-            SDL_UnlockTexture( texture );
-            chip.screenDrawn = false;
-            SDL_RenderCopy( renderer, texture, NULL, NULL );
+        if (frames->update())
+        {
+            const Frame& frame = frames->readSlot();
+            forEachRowRun(frame.dirtyRows, frame.height, [&](int first, int count)
+            {
+                SDL_Rect rows = { 0, first, frame.width, count };
+                SDL_UpdateTexture( texture, &rows, &frame.pixels[first * HIRES_WIDTH], HIRES_WIDTH * sizeof(uint32_t) );
+            });
+            SDL_Rect screenRect = { 0, 0, frame.width, frame.height };
+            // the texture fits the high resolution screen, low resolution only uses its top left corner
+            SDL_RenderCopy( renderer, texture, &screenRect, NULL );
             SDL_RenderPresent( renderer );
+            if (frame.hasInput)
+            {
+                latency.add(Clock::now() - frame.inputTime);
+            }
         }
+    }
+
+    input.quit.store(true);
+    emulation.join();
 
-        delay_currentTime = cycle_currentTime = SDL_GetTicks();
+    if (latency.samples)
+    {
+        printf("input to photon latency over %llu key changes: %.1f ms mean, %.1f ms worst\n",
+            (unsigned long long)latency.samples, latency.totalMs / latency.samples, latency.maxMs);
     }
 
+#ifdef CHIP8_PROFILE
+    profiler->dump(chip, stdout);
+#endif
+
+    if (audioDevice)
+    {
+        SDL_CloseAudioDevice(audioDevice);
+    }
     SDL_DestroyWindow( window );
     SDL_DestroyRenderer( renderer );
     SDL_DestroyTexture( texture );
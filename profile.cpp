@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <vector>
+#include "profile.h"
+
+namespace
+{
+    // what each top nibble covers, for the class table
+    const char* const classNames[OPCODE_CLASSES] =
+    {
+        "0nnn cls/ret/scroll", "1nnn jp", "2nnn call", "3xkk se", "4xkk sne", "5xy0 se", "6xkk ld", "7xkk add",
+        "8xyn alu", "9xy0 sne", "Annn ld i", "Bnnn jp v0", "Cxkk rnd", "Dxyn drw", "Ex9E/ExA1 skp", "Fx** misc"
+    };
+
+    double percent(uint64_t part, uint64_t whole)
+    {
+        return whole ? 100.0 * part / whole : 0.0;
+    }
+}
+
+Profiler::Profiler()
+{
+    reset();
+}
+
+void Profiler::reset()
+{
+    instructions = 0;
+    std::fill(classCounts, classCounts + OPCODE_CLASSES, 0);
+    std::fill(addressCounts, addressCounts + MEM_SIZE, 0);
+    std::fill(routineCounts, routineCounts + MEM_SIZE, 0);
+    runNanos = 0;
+    drawNanos = 0;
+    calls.clear();
+    routines[0] = PROGRAM_ADDRESS;
+    depth = 0;
+}
+
+void Profiler::call(uint16_t target)
+{
+    target &= ADDRESS_MASK;
+    ++calls[std::make_pair(routines[depth], target)];
+    // a program overflowing the stack keeps being charged to the deepest routine
+    if (depth < PROFILE_MAX_DEPTH)
+    {
+        routines[++depth] = target;
+    }
+}
+
+void Profiler::ret()
+{
+    if (depth > 0)
+    {
+        --depth;
+    }
+}
+
+void Profiler::dump(const Chip8& chip, FILE* file) const
+{
+    std::fprintf(file, "%llu instructions, %.3f ms running, %.3f ms drawing (%.1f%%)\n",
+        (unsigned long long)instructions, runNanos / 1e6, drawNanos / 1e6, percent(drawNanos, runNanos));
+
+    std::fprintf(file, "\nopcode class          count      share\n");
+    for (auto i = 0; i < OPCODE_CLASSES; ++i)
+    {
+        if (classCounts[i])
+        {
+            std::fprintf(file, "%-16s %12llu %9.2f%%\n", classNames[i], (unsigned long long)classCounts[i], percent(classCounts[i], instructions));
+        }
+    }
+
+    std::vector<uint16_t> hot;
+    for (auto addr = 0; addr < MEM_SIZE; ++addr)
+    {
+        if (addressCounts[addr])
+        {
+            hot.push_back(addr);
+        }
+    }
+    size_t shown = std::min(hot.size(), (size_t)PROFILE_HOT_ADDRESSES);
+    std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(), [this](uint16_t a, uint16_t b)
+    {
+        return addressCounts[a] > addressCounts[b];
+    });
+
+    std::fprintf(file, "\naddress  opcode        count      share\n");
+    for (size_t i = 0; i < shown; ++i)
+    {
+        uint16_t addr = hot[i];
+        uint16_t opcode = ((uint16_t)chip.mem[addr] << 8) + chip.mem[(addr + 1) & ADDRESS_MASK];
+        std::fprintf(file, "0x%04X   %04X   %12llu %9.2f%%\n", addr, opcode, (unsigned long long)addressCounts[addr], percent(addressCounts[addr], instructions));
+    }
+
+    std::fprintf(file, "\nroutine  instructions      share\n");
+    for (auto addr = 0; addr < MEM_SIZE; ++addr)
+    {
+        if (routineCounts[addr])
+        {
+            std::fprintf(file, "0x%04X   %12llu %9.2f%%\n", addr, (unsigned long long)routineCounts[addr], percent(routineCounts[addr], instructions));
+        }
+    }
+
+    std::fprintf(file, "\ncaller   callee         calls\n");
+    for (const auto& edge : calls)
+    {
+        std::fprintf(file, "0x%04X -> 0x%04X %12llu\n", edge.first.first, edge.first.second, (unsigned long long)edge.second);
+    }
+}
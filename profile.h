@@ -0,0 +1,69 @@
+#ifndef CHIP8_PROFILER
+#define CHIP8_PROFILER
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <utility>
+#include "chip8.h"
+
+// Execution profile. Chip8 only feeds a Profiler when built with
+// CHIP8_PROFILE defined (make PROFILE=1); otherwise the hooks compile to nothing.
+// Instructions run inside JIT blocks are not counted.
+
+constexpr int OPCODE_CLASSES = 16; // instructions are grouped by their top nibble
+constexpr int PROFILE_HOT_ADDRESSES = 20; // rows in the dumped histogram
+constexpr int PROFILE_MAX_DEPTH = 16; // matches the chip8 stack
+
+struct Profiler {
+    Profiler();
+
+    uint64_t instructions;
+    uint64_t classCounts[OPCODE_CLASSES];
+    uint64_t addressCounts[MEM_SIZE];
+    uint64_t routineCounts[MEM_SIZE]; // instructions executed inside each subroutine, indexed by its entry address
+
+    uint64_t runNanos;  // wall time inside Chip8::runCycles
+    uint64_t drawNanos; // the part of it spent in Chip8::draw
+
+    // call graph edges, (calling routine, called routine) -> calls
+    std::map<std::pair<uint16_t, uint16_t>, uint64_t> calls;
+    uint16_t routines[PROFILE_MAX_DEPTH + 1]; // entry addresses of the routines on the call stack, the program itself at the bottom
+    int depth;
+
+    void instruction(uint16_t pc, uint8_t highByte)
+    {
+        ++instructions;
+        ++classCounts[highByte >> 4];
+        ++addressCounts[pc & ADDRESS_MASK];
+        ++routineCounts[routines[depth]];
+    }
+
+    void call(uint16_t target);
+    void ret();
+    void reset();
+
+    // writes the opcode class table, the hottest addresses with the opcode found there now, and the call graph
+    void dump(const Chip8& chip, FILE* file) const;
+};
+
+// adds the wall time of its own lifetime to a counter, nothing when the counter is null
+struct ProfileTimer {
+    ProfileTimer(uint64_t* nanos): nanos(nanos), start(nanos ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point())
+    {
+    }
+
+    ~ProfileTimer()
+    {
+        if (nanos)
+        {
+            *nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    uint64_t* nanos;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include <cstring>
+#include "record.h"
+
+namespace
+{
+    void writeVarint(FILE* file, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            std::fputc((value & 0x7F) | 0x80, file);
+            value >>= 7;
+        }
+        std::fputc(value, file);
+    }
+
+    bool readVarint(FILE* file, uint64_t& value)
+    {
+        value = 0;
+        for (auto shift = 0; shift < 64; shift += 7)
+        {
+            int byte = std::fgetc(file);
+            if (byte == EOF)
+            {
+                return false;
+            }
+            value |= (uint64_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename T>
+    bool readValue(FILE* file, T& value)
+    {
+        return std::fread(&value, sizeof(value), 1, file) == 1;
+    }
+}
+
+Recorder::Recorder(): file(nullptr), lastCycle(0), endCycle(0), keypad(0), screenHash(0)
+{
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+bool Recorder::open(const char* filename, const Chip8& chip, int cyclesPerFrame)
+{
+    file = std::fopen(filename, "wb");
+    if (!file)
+    {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+
+    RecordingHeader header = { RECORDING_MAGIC, RECORDING_VERSION, (uint32_t)cyclesPerFrame, chip.quirks, chip.hashState(), {} };
+    std::memcpy(header.rngState, chip.rngState, sizeof(header.rngState));
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    lastCycle = endCycle = chip.cycleCount;
+    keypad = 0;
+    screenHash = (uint32_t)chip.hashScreen();
+    return true;
+}
+
+void Recorder::event(const Chip8& chip, RecordingEvent type)
+{
+    writeVarint(file, chip.cycleCount - lastCycle);
+    std::fputc(type, file);
+    lastCycle = chip.cycleCount;
+}
+
+void Recorder::input(const Chip8& chip, uint16_t held, uint16_t released)
+{
+    if (!file)
+    {
+        return;
+    }
+    if (held != keypad)
+    {
+        event(chip, EVENT_KEYPAD);
+        std::fwrite(&held, sizeof(held), 1, file);
+        keypad = held;
+    }
+    if (released)
+    {
+        event(chip, EVENT_KEYUP);
+        std::fwrite(&released, sizeof(released), 1, file);
+    }
+}
+
+void Recorder::frame(const Chip8& chip)
+{
+    if (!file)
+    {
+        return;
+    }
+    endCycle = chip.cycleCount;
+    uint32_t hash = (uint32_t)chip.hashScreen();
+    if (hash != screenHash)
+    {
+        event(chip, EVENT_FRAME);
+        std::fwrite(&hash, sizeof(hash), 1, file);
+        screenHash = hash;
+    }
+}
+
+void Recorder::close()
+{
+    if (!file)
+    {
+        return;
+    }
+    // the end marker carries the frames run since the last event
+    writeVarint(file, endCycle - lastCycle);
+    std::fputc(EVENT_END, file);
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool replay(const char* filename, Chip8& chip, uint64_t& frames)
+{
+    frames = 0;
+
+    FILE* file = std::fopen(filename, "rb");
+    if (!file)
+    {
+        printf("File not found\n");
+        return false;
+    }
+
+    RecordingHeader header;
+    if (!readValue(file, header) || header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION || !header.cyclesPerFrame || header.quirks >= QUIRK_PROFILE_COUNT)
+    {
+        printf("Not a chip8 recording\n");
+        std::fclose(file);
+        return false;
+    }
+
+    std::memcpy(chip.rngState, header.rngState, sizeof(chip.rngState));
+    if (chip.quirks != header.quirks)
+    {
+        // the same ROM runs differently under another profile
+        chip.quirks = (QuirkProfile)header.quirks;
+        chip.resetCode();
+    }
+    if (chip.hashState() != header.startHash)
+    {
+        printf("Recording was made from a different ROM or starting state\n");
+        std::fclose(file);
+        return false;
+    }
+
+    uint16_t keypad = 0;
+    uint16_t keyUp = 0;
+    uint64_t now = 0;
+    uint64_t nextTick = header.cyclesPerFrame;
+    uint64_t mismatches = 0;
+
+    for (;;)
+    {
+        uint64_t delta;
+        int type;
+        if (!readVarint(file, delta) || (type = std::fgetc(file)) == EOF)
+        {
+            printf("Recording ends without an end marker\n");
+            break;
+        }
+
+        // run up to the event, ticking the timers on the same frame boundaries the recording had
+        uint64_t target = now + delta;
+        while (now < target)
+        {
+            uint64_t step = (nextTick < target ? nextTick : target) - now;
+            chip.runCycles(step, keypad, keyUp);
+            now += step;
+            if (now == nextTick)
+            {
+                chip.tickTimers();
+                nextTick += header.cyclesPerFrame;
+            }
+        }
+
+        bool valid = true;
+        if (type == EVENT_KEYPAD)
+        {
+            valid = readValue(file, keypad);
+        }
+        else if (type == EVENT_KEYUP)
+        {
+            uint16_t released;
+            valid = readValue(file, released);
+            keyUp |= released;
+        }
+        else if (type == EVENT_FRAME)
+        {
+            uint32_t hash;
+            valid = readValue(file, hash);
+            ++frames;
+            if (valid && hash != (uint32_t)chip.hashScreen())
+            {
+                if (!mismatches)
+                {
+                    printf("Frame hash differs at cycle %llu\n", (unsigned long long)now);
+                }
+                ++mismatches;
+            }
+        }
+        else if (type == EVENT_END)
+        {
+            std::fclose(file);
+            return mismatches == 0;
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            printf("Corrupt recording at cycle %llu\n", (unsigned long long)now);
+            break;
+        }
+    }
+
+    std::fclose(file);
+    return false;
+}
@@ -0,0 +1,55 @@
+#ifndef CHIP8_RECORD
+#define CHIP8_RECORD
+
+#include <cstdint>
+#include <cstdio>
+#include "chip8.h"
+
+constexpr uint32_t RECORDING_MAGIC = 0x43523843; // "C8RC" in a little-endian file
+constexpr uint32_t RECORDING_VERSION = 6;
+
+// file layout, all fields little-endian
+struct RecordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cyclesPerFrame; // timers tick every this many instructions
+    uint32_t quirks;         // Chip8::quirks the ROM was loaded with
+    uint64_t startHash;      // Chip8::hashState when recording started, catches a different ROM
+    uint32_t rngState[4];    // Chip8::rngState when recording started
+};
+
+// Each event after the header is a varint count of instructions since the
+// previous event, a type byte and its payload.
+enum RecordingEvent : uint8_t
+{
+    EVENT_KEYPAD = 1, // uint16 keypad mask held from now on
+    EVENT_KEYUP = 2,  // uint16 mask of keys released, added to keyUp for Fx0A
+    EVENT_FRAME = 3,  // uint32 low half of Chip8::hashScreen, written only when the screen changed
+    EVENT_END = 4     // no payload, the run ends once its instruction count has executed
+};
+
+// Logs everything that feeds a run from outside the core, against the cycle it happened at,
+// so a replay can reproduce the run exactly. Recording must start on a frame boundary.
+struct Recorder {
+    Recorder();
+    ~Recorder();
+
+    FILE* file;
+    uint64_t lastCycle;  // cycle of the previous event
+    uint64_t endCycle;   // cycle at the end of the last frame
+    uint16_t keypad;     // keypad mask last logged
+    uint32_t screenHash; // last logged frame hash
+
+    bool open(const char* filename, const Chip8& chip, int cyclesPerFrame);
+    void input(const Chip8& chip, uint16_t held, uint16_t released); // call before each frame
+    void frame(const Chip8& chip);                                  // call after each frame
+    void close();
+
+    void event(const Chip8& chip, RecordingEvent type);
+};
+
+// Replays a recording into chip, which must hold the same freshly loaded ROM, as fast as possible.
+// Returns false on a bad file or if any frame hash differs; frames counts the hashes compared.
+bool replay(const char* filename, Chip8& chip, uint64_t& frames);
+
+#endif
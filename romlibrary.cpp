@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "romlibrary.h"
+
+namespace
+{
+    bool parseHash(const char* text, uint64_t& hash)
+    {
+        char* end;
+        if (std::strlen(text) != 16)
+        {
+            return false;
+        }
+        hash = std::strtoull(text, &end, 16);
+        return *end == '\0';
+    }
+
+    // maps a regular file read-only, null for anything that cannot be a ROM
+    const uint8_t* mapFile(const std::string& path, size_t& size)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+        struct stat info;
+        void* data = MAP_FAILED;
+        if (!fstat(fd, &info) && S_ISREG(info.st_mode) && info.st_size > 0 && info.st_size <= MEM_SIZE - PROGRAM_ADDRESS)
+        {
+            size = info.st_size;
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        // the mapping outlives the descriptor
+        ::close(fd);
+        return data == MAP_FAILED ? nullptr : static_cast<const uint8_t*>(data);
+    }
+
+    // adds the entries of an index file to index, a missing file adds nothing
+    void readIndex(const std::string& path, std::unordered_map<uint64_t, RomSettings>& index)
+    {
+        FILE* file = std::fopen(path.c_str(), "r");
+        if (!file)
+        {
+            return;
+        }
+        char hashText[32], profileName[32], layout[32];
+        int ips;
+        int line = 0;
+        while (std::fscanf(file, "%31s %31s %d %31s", hashText, profileName, &ips, layout) == 4)
+        {
+            ++line;
+            uint64_t hash;
+            RomSettings settings = defaultRomSettings();
+            if (!parseHash(hashText, hash) || !parseQuirkProfile(profileName, settings.quirks) || ips <= 0 || std::strlen(layout) != KEY_COUNT)
+            {
+                printf("Skipping bad entry %d in %s\n", line, path.c_str());
+                continue;
+            }
+            settings.ips = ips;
+            std::strcpy(settings.keyLayout, layout);
+            index[hash] = settings;
+        }
+        std::fclose(file);
+    }
+
+    // the whole file, empty if it cannot be read
+    std::string readText(const std::string& path)
+    {
+        std::string text;
+        if (FILE* file = std::fopen(path.c_str(), "r"))
+        {
+            char buffer[4096];
+            size_t got;
+            while ((got = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            {
+                text.append(buffer, got);
+            }
+            std::fclose(file);
+        }
+        return text;
+    }
+}
+
+RomSettings defaultRomSettings()
+{
+    RomSettings settings = { QUIRKS_MODERN, DEFAULT_IPS, {} };
+    std::strcpy(settings.keyLayout, DEFAULT_KEY_LAYOUT);
+    return settings;
+}
+
+RomLibrary::RomLibrary()
+{
+}
+
+RomLibrary::~RomLibrary()
+{
+    close();
+}
+
+bool RomLibrary::open(const char* path)
+{
+    close();
+    directory = path;
+
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        printf("Could not open ROM directory %s\n", path);
+        return false;
+    }
+    while (dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.' || !std::strcmp(entry->d_name, ROM_INDEX_FILE))
+        {
+            continue;
+        }
+        Rom rom = { entry->d_name, 0, nullptr, 0, defaultRomSettings() };
+        rom.data = mapFile(directory + "/" + rom.name, rom.size);
+        if (rom.data)
+        {
+            rom.hash = hashBytes(rom.data, rom.size);
+            roms.push_back(rom);
+        }
+    }
+    closedir(dir);
+
+    std::sort(roms.begin(), roms.end(), [](const Rom& a, const Rom& b) { return a.name < b.name; });
+
+    // a missing index is not an error, it is written below
+    std::string indexPath = directory + "/" + ROM_INDEX_FILE;
+    readIndex(indexPath, index);
+
+    bool indexChanged = false;
+    for (size_t i = 0; i < roms.size(); ++i)
+    {
+        Rom& rom = roms[i];
+        // identical files are one ROM, the first name wins
+        byHash.emplace(rom.hash, i);
+        auto known = index.find(rom.hash);
+        if (known != index.end())
+        {
+            rom.settings = known->second;
+        }
+        else
+        {
+            index[rom.hash] = rom.settings;
+            indexChanged = true;
+        }
+    }
+
+    // a read-only library still works, the new ROMs just run with default settings
+    if (indexChanged)
+    {
+        // another process may have written the index since it was read; what it wrote wins over these defaults
+        std::unordered_map<uint64_t, RomSettings> latest;
+        readIndex(indexPath, latest);
+        for (const auto& entry : latest)
+        {
+            index[entry.first] = entry.second;
+        }
+        for (Rom& rom : roms)
+        {
+            rom.settings = index[rom.hash];
+        }
+        saveIndex();
+    }
+    return true;
+}
+
+void RomLibrary::close()
+{
+    for (const Rom& rom : roms)
+    {
+        munmap(const_cast<uint8_t*>(rom.data), rom.size);
+    }
+    roms.clear();
+    byHash.clear();
+    index.clear();
+}
+
+// Other processes may be reading the index while it is saved, so it is
+// written to a temporary file next to it and renamed over it: a reader sees
+// the old index or the new one, never a truncated one.
+bool RomLibrary::saveIndex() const
+{
+    // sorted so the file diffs cleanly when it is kept alongside the ROMs
+    std::vector<uint64_t> hashes;
+    for (const auto& entry : index)
+    {
+        hashes.push_back(entry.first);
+    }
+    std::sort(hashes.begin(), hashes.end());
+
+    std::string text;
+    for (uint64_t hash : hashes)
+    {
+        const RomSettings& settings = index.at(hash);
+        char line[96];
+        std::snprintf(line, sizeof(line), "%016llx %s %d %s\n", (unsigned long long)hash, QUIRK_PROFILE_NAMES[settings.quirks], settings.ips, settings.keyLayout);
+        text += line;
+    }
+
+    std::string path = directory + "/" + ROM_INDEX_FILE;
+    if (text == readText(path))
+    {
+        return true;
+    }
+
+    // a dot file, so a library opened meanwhile does not take it for a ROM
+    std::string temporary = directory + "/." + ROM_INDEX_FILE + "." + std::to_string(getpid());
+    FILE* file = std::fopen(temporary.c_str(), "w");
+    bool written = file && std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = file && !std::fclose(file) && written;
+    if (!written || std::rename(temporary.c_str(), path.c_str()))
+    {
+        printf("Could not write %s\n", path.c_str());
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+const Rom* RomLibrary::find(uint64_t hash) const
+{
+    auto found = byHash.find(hash);
+    return found == byHash.end() ? nullptr : &roms[found->second];
+}
+
+const Rom* RomLibrary::find(const char* nameOrHash) const
+{
+    auto named = std::lower_bound(roms.begin(), roms.end(), nameOrHash, [](const Rom& rom, const char* name) { return rom.name < name; });
+    if (named != roms.end() && named->name == nameOrHash)
+    {
+        return &*named;
+    }
+    uint64_t hash;
+    return parseHash(nameOrHash, hash) ? find(hash) : nullptr;
+}
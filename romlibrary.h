@@ -0,0 +1,61 @@
+#ifndef CHIP8_ROMLIBRARY
+#define CHIP8_ROMLIBRARY
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "chip8.h"
+
+// index file kept in the library directory, one line per ROM:
+// <16 hex digit hash> <quirk profile> <instructions per second> <key layout>
+const char* const ROM_INDEX_FILE = "chip8-index.txt";
+const char* const DEFAULT_KEY_LAYOUT = "x123qweasdzc4rfv"; // host key for chip8 keys 0 to F
+constexpr int DEFAULT_IPS = DEFAULT_CYCLES_PER_FRAME * TIMER_FREQ;
+
+// how a ROM wants to be run, looked up by the hash of its contents
+struct RomSettings {
+    QuirkProfile quirks;
+    int ips; // instructions per second, the frontends run ips / TIMER_FREQ per frame
+    char keyLayout[KEY_COUNT + 1];
+
+    int cyclesPerFrame() const { return ips / TIMER_FREQ > 0 ? ips / TIMER_FREQ : 1; }
+};
+
+RomSettings defaultRomSettings();
+
+// A ROM file mapped read-only. data stays valid for as long as the library
+// that mapped it, so any number of Chip8 instances can load from it.
+struct Rom {
+    std::string name; // file name inside the library directory
+    uint64_t hash;
+    const uint8_t* data;
+    size_t size;
+    RomSettings settings;
+};
+
+// Maps every ROM in a directory once and indexes it by content, so starting
+// another instance is a hash table lookup and a copy into chip8 memory,
+// with no file access. Files too large for chip8 memory are skipped.
+struct RomLibrary {
+    RomLibrary();
+    ~RomLibrary();
+    RomLibrary(const RomLibrary&) = delete;
+    RomLibrary& operator=(const RomLibrary&) = delete;
+
+    std::string directory;
+    std::vector<Rom> roms; // sorted by name
+    std::unordered_map<uint64_t, size_t> byHash; // hash -> index into roms
+    std::unordered_map<uint64_t, RomSettings> index; // as read from the index file, may name ROMs not present
+
+    // maps the directory's ROMs and reads its index, writing the index back if any ROM was new to it
+    bool open(const char* path);
+    void close();
+    bool saveIndex() const; // replaces the index file in one rename, and leaves it alone if it would not change
+
+    const Rom* find(uint64_t hash) const;
+    const Rom* find(const char* nameOrHash) const; // a file name in the directory, or a 16 digit hex hash
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "aot.h"
+#include "lanes.h"
+#include "runner.h"
+
+namespace
+{
+    // a job's loaded Chip8 ready to run, false if the ROM did not fit
+    bool start(Chip8& chip, const Job& job)
+    {
+        if (!chip.loadBytes(job.rom, job.romSize, job.quirks))
+        {
+            return false;
+        }
+        chip.PC = PROGRAM_ADDRESS;
+        chip.seedRandom(job.seed);
+        return true;
+    }
+
+    // moves on to the keys held in a frame, frames past the end of the script hold none
+    void pressKeys(const Job& job, int frame, uint16_t& keypad, uint16_t& keyUp)
+    {
+        uint16_t held = 0;
+        if (job.keypad && frame < (int)job.keypad->size())
+        {
+            held = (*job.keypad)[frame];
+        }
+
+        // keys held last frame but not this one count as released for Fx0A
+        keyUp |= keypad & ~held;
+        keypad = held;
+    }
+}
+
+JobResult runJob(const Job& job)
+{
+    JobResult result = { false, 0, 0, {} };
+
+    // Chip8 is too large to keep on a worker thread's stack
+    std::unique_ptr<Chip8> chip(new Chip8());
+    if (!start(*chip, job))
+    {
+        return result;
+    }
+
+    // every job opens the module itself, the dynamic loader maps it once however many do
+    std::unique_ptr<Aot> aot;
+    if (job.module)
+    {
+        aot.reset(new Aot(*chip));
+        if (!aot->load(job.module))
+        {
+            return result;
+        }
+    }
+    result.loaded = true;
+
+    result.frameHashes.reserve(job.frames);
+    uint16_t keypad = 0;
+    uint16_t keyUp = 0;
+
+    for (auto frame = 0; frame < job.frames; ++frame)
+    {
+        pressKeys(job, frame, keypad, keyUp);
+        if (aot)
+        {
+            aot->runCycles(job.cyclesPerFrame, keypad, keyUp);
+            chip->tickTimers();
+        }
+        else
+        {
+            chip->runFrame(job.cyclesPerFrame, keypad, keyUp);
+        }
+        result.frameHashes.push_back(chip->hashScreen());
+    }
+
+    result.cycles = chip->cycleCount;
+    result.stateHash = chip->hashState();
+    return result;
+}
+
+// Runs up to N jobs in the lanes of one engine, frame by frame, each lane
+// sitting out once its own job has run all its frames.
+template <int N>
+void runLaneJobs(const Job* jobs, int count, JobResult* results)
+{
+    std::unique_ptr<Lanes<N>> lanes(new Lanes<N>());
+    int cycles[N] = {};
+    uint16_t keypad[N] = {};
+    uint16_t keyUp[N] = {};
+
+    int frames = 0;
+    for (auto l = 0; l < count; ++l)
+    {
+        results[l] = JobResult{ false, 0, 0, {} };
+        results[l].loaded = start(*lanes->chips[l], jobs[l]);
+        if (results[l].loaded)
+        {
+            results[l].frameHashes.reserve(jobs[l].frames);
+            frames = std::max(frames, jobs[l].frames);
+        }
+    }
+
+    for (auto frame = 0; frame < frames; ++frame)
+    {
+        for (auto l = 0; l < count; ++l)
+        {
+            bool running = results[l].loaded && frame < jobs[l].frames;
+            cycles[l] = running ? jobs[l].cyclesPerFrame : 0;
+            if (running)
+            {
+                pressKeys(jobs[l], frame, keypad[l], keyUp[l]);
+            }
+        }
+
+        lanes->runCycles(cycles, keypad, keyUp);
+
+        for (auto l = 0; l < count; ++l)
+        {
+            if (results[l].loaded && frame < jobs[l].frames)
+            {
+                lanes->chips[l]->tickTimers();
+                results[l].frameHashes.push_back(lanes->chips[l]->hashScreen());
+            }
+        }
+    }
+
+    for (auto l = 0; l < count; ++l)
+    {
+        if (results[l].loaded)
+        {
+            results[l].cycles = lanes->chips[l]->cycleCount;
+            results[l].stateHash = lanes->chips[l]->hashState();
+        }
+    }
+}
+
+namespace
+{
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<size_t> jobs; // indices into the job list
+    };
+
+    // owner takes from the front, thieves from the back, so they rarely contend for the same end
+    bool take(WorkQueue& queue, size_t& job, bool steal)
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.jobs.empty())
+        {
+            return false;
+        }
+        if (steal)
+        {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+        else
+        {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        return true;
+    }
+}
+
+std::vector<JobResult> runJobs(const std::vector<Job>& jobs, int threads, int lanes)
+{
+    std::vector<JobResult> results(jobs.size());
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (lanes != 8 && lanes != 16 && lanes != 32)
+    {
+        lanes = 1;
+    }
+
+    // contiguous slices keep neighbouring jobs, which often share a ROM, on one thread;
+    // with lanes the queues hold the first job of each group
+    std::vector<WorkQueue> queues(threads);
+    size_t groups = (jobs.size() + lanes - 1) / lanes;
+    for (size_t i = 0; i < groups; ++i)
+    {
+        queues[i * threads / groups].jobs.push_back(i * lanes);
+    }
+
+    auto worker = [&](int self)
+    {
+        size_t job;
+        for (;;)
+        {
+            bool found = take(queues[self], job, false);
+            for (auto i = 1; !found && i < threads; ++i)
+            {
+                found = take(queues[(self + i) % threads], job, true);
+            }
+            // jobs are never added once workers start, so empty queues everywhere means done
+            if (!found)
+            {
+                return;
+            }
+            int count = std::min<size_t>(lanes, jobs.size() - job);
+            switch (lanes)
+            {
+                case (8):
+                    runLaneJobs<8>(&jobs[job], count, &results[job]);
+                    break;
+                case (16):
+                    runLaneJobs<16>(&jobs[job], count, &results[job]);
+                    break;
+                case (32):
+                    runLaneJobs<32>(&jobs[job], count, &results[job]);
+                    break;
+                default:
+                    results[job] = runJob(jobs[job]);
+                    break;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (auto i = 1; i < threads; ++i)
+    {
+        pool.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread : pool)
+    {
+        thread.join();
+    }
+
+    return results;
+}
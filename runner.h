@@ -0,0 +1,41 @@
+#ifndef CHIP8_RUNNER
+#define CHIP8_RUNNER
+
+#include <cstdint>
+#include <vector>
+#include "chip8.h"
+
+// One independent emulator run. Jobs share the ROM and input script they
+// point at, which must stay alive and unchanged until runJobs returns;
+// a RomLibrary mapping works as well as a buffer.
+struct Job {
+    const uint8_t* rom;
+    size_t romSize;
+    const std::vector<uint16_t>* keypad; // keypad mask for each frame, frames past the end hold no keys; may be nullptr
+    uint64_t seed;       // passed to Chip8::seedRandom
+    int frames;
+    int cyclesPerFrame;
+    QuirkProfile quirks;
+    const char* module;  // shared object chip8-aot compiled the ROM into, nullptr to interpret
+};
+
+struct JobResult {
+    bool loaded;                      // false if the ROM did not fit in memory or the module could not be used
+    uint64_t cycles;                  // instructions executed, fewer than frames * cyclesPerFrame if the program halted
+    uint64_t stateHash;               // Chip8::hashState after the last frame
+    std::vector<uint64_t> frameHashes; // Chip8::hashScreen after every frame
+};
+
+// Runs a single job on the calling thread.
+JobResult runJob(const Job& job);
+
+// Runs every job on a pool of threads, each with its own work queue.
+// A thread that empties its queue steals from the back of another's.
+// Results are returned in the order of jobs.
+//
+// With lanes of 8, 16 or 32 the unit of work is that many consecutive jobs,
+// run side by side on one thread by a Lanes engine with the same results as
+// running them one at a time; modules are not used then.
+std::vector<JobResult> runJobs(const std::vector<Job>& jobs, int threads, int lanes = 1);
+
+#endif
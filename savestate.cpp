@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "savestate.h"
+
+void saveState(const Chip8& chip, Snapshot& snapshot)
+{
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.version = SNAPSHOT_VERSION;
+    // memory an earlier save left above what this chip uses has to read as zero again
+    if (snapshot.memUsed > chip.memUsed)
+    {
+        std::memset(snapshot.mem + chip.memUsed, 0, snapshot.memUsed - chip.memUsed);
+    }
+    snapshot.memUsed = chip.memUsed;
+    std::memcpy(snapshot.mem, chip.mem, chip.memUsed);
+    std::memcpy(snapshot.screen, chip.screen, sizeof(snapshot.screen));
+    snapshot.planes = chip.planes;
+    snapshot.hires = chip.hires;
+    std::memcpy(snapshot.V, chip.V, sizeof(snapshot.V));
+    std::memcpy(snapshot.stack, chip.stack, sizeof(snapshot.stack));
+    snapshot.I = chip.I;
+    snapshot.DT = chip.DT;
+    snapshot.ST = chip.ST;
+    snapshot.PC = chip.PC;
+    snapshot.SP = chip.SP;
+    std::memcpy(snapshot.rngState, chip.rngState, sizeof(snapshot.rngState));
+    std::memcpy(snapshot.rpl, chip.rpl, sizeof(snapshot.rpl));
+    std::memcpy(snapshot.audioPattern, chip.audioPattern, sizeof(snapshot.audioPattern));
+    snapshot.pitch = chip.pitch;
+    snapshot.halt = chip.halt;
+}
+
+bool restoreState(Chip8& chip, const Snapshot& snapshot)
+{
+    if (snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION || snapshot.memUsed > MEM_SIZE)
+    {
+        printf("Unsupported save state\n");
+        return false;
+    }
+
+    // only addresses that actually change lose their decoded instructions, and above what both use nothing can
+    uint32_t used = std::max(chip.memUsed, snapshot.memUsed);
+    chip.storeBytes(snapshot.mem, used);
+
+    if (chip.hires != (bool)snapshot.hires)
+    {
+        chip.hires = snapshot.hires;
+        chip.dirtyRows = ALL_ROWS;
+    }
+    for (auto p = 0; p < PLANE_COUNT; ++p)
+    {
+        // most frames leave a plane alone, or it is empty in low resolution
+        if (std::memcmp(chip.screen[p], snapshot.screen[p], sizeof(chip.screen[p])) == 0)
+        {
+            continue;
+        }
+        for (auto y = 0; y < HIRES_HEIGHT; ++y)
+        {
+            if (std::memcmp(chip.screen[p][y], snapshot.screen[p][y], sizeof(chip.screen[p][y])) != 0)
+            {
+                std::memcpy(chip.screen[p][y], snapshot.screen[p][y], sizeof(chip.screen[p][y]));
+                chip.dirtyRows |= (uint64_t)1 << y;
+            }
+        }
+    }
+    chip.planes = snapshot.planes;
+
+    std::memcpy(chip.V, snapshot.V, sizeof(chip.V));
+    std::memcpy(chip.stack, snapshot.stack, sizeof(chip.stack));
+    chip.I = snapshot.I;
+    chip.DT = snapshot.DT;
+    chip.ST = snapshot.ST;
+    chip.PC = snapshot.PC;
+    chip.SP = snapshot.SP;
+    std::memcpy(chip.rngState, snapshot.rngState, sizeof(chip.rngState));
+    std::memcpy(chip.rpl, snapshot.rpl, sizeof(chip.rpl));
+    std::memcpy(chip.audioPattern, snapshot.audioPattern, sizeof(chip.audioPattern));
+    chip.pitch = snapshot.pitch;
+    chip.halt = (Halt)snapshot.halt;
+    chip.memUsed = used;
+    return true;
+}
+
+bool writeSnapshot(const char* filename, const Snapshot& snapshot)
+{
+    FILE* file = std::fopen(filename, "wb");
+    if (!file)
+    {
+        printf("Could not open %s\n", filename);
+        return false;
+    }
+    // a full disk can show up as a short write or only when the buffered rest is flushed on close
+    bool written = std::fwrite(&snapshot, sizeof(snapshot), 1, file) == 1;
+    if (std::fclose(file) || !written)
+    {
+        printf("Could not write %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+bool readSnapshot(const char* filename, Snapshot& snapshot)
+{
+    FILE* file = std::fopen(filename, "rb");
+    if (!file)
+    {
+        printf("File not found\n");
+        return false;
+    }
+    bool read = std::fread(&snapshot, sizeof(snapshot), 1, file) == 1;
+    std::fclose(file);
+    if (!read || snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION || snapshot.memUsed > MEM_SIZE)
+    {
+        printf("Unsupported save state\n");
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+    // bytes from the start of snapshot up to the end of the memory it uses, everything after is zero
+    size_t usedBytes(const Snapshot& snapshot)
+    {
+        return offsetof(Snapshot, mem) + snapshot.memUsed;
+    }
+
+    // assigns from to to, copying only what either uses
+    void copySnapshot(Snapshot& to, const Snapshot& from)
+    {
+        std::memcpy(&to, &from, std::max(usedBytes(to), usedBytes(from)));
+    }
+
+    uint8_t* writeVarint(uint8_t* out, size_t value)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        *out++ = value;
+        return out;
+    }
+
+    const uint8_t* readVarint(const uint8_t* in, size_t& value)
+    {
+        value = 0;
+        for (auto shift = 0; ; shift += 7)
+        {
+            value |= (size_t)(*in & 0x7F) << shift;
+            if (!(*in++ & 0x80))
+            {
+                return in;
+            }
+        }
+    }
+
+    // Codes the XOR of two snapshots as (equal bytes to skip, differing byte count, XORed bytes) runs.
+    size_t encodeDelta(const Snapshot& from, const Snapshot& to, uint8_t* out)
+    {
+        const uint8_t* a = reinterpret_cast<const uint8_t*>(&from);
+        const uint8_t* b = reinterpret_cast<const uint8_t*>(&to);
+        const size_t size = std::max(usedBytes(from), usedBytes(to));
+        uint8_t* start = out;
+        size_t i = 0;
+
+        while (i < size)
+        {
+            size_t equalFrom = i;
+            // most of a frame's delta is untouched memory, skip it a word at a time
+            while (i + 8 <= size && std::memcmp(a + i, b + i, 8) == 0)
+            {
+                i += 8;
+            }
+            while (i < size && a[i] == b[i])
+            {
+                ++i;
+            }
+            if (i == size)
+            {
+                break;
+            }
+
+            size_t differFrom = i;
+            while (i < size && a[i] != b[i])
+            {
+                ++i;
+            }
+
+            out = writeVarint(out, differFrom - equalFrom);
+            out = writeVarint(out, i - differFrom);
+            for (auto j = differFrom; j < i; ++j)
+            {
+                *out++ = a[j] ^ b[j];
+            }
+        }
+        return out - start;
+    }
+
+    void applyDelta(Snapshot& snapshot, const uint8_t* in, size_t length)
+    {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(&snapshot);
+        const uint8_t* end = in + length;
+        size_t pos = 0;
+
+        while (in < end)
+        {
+            size_t skip, count;
+            in = readVarint(in, skip);
+            in = readVarint(in, count);
+            pos += skip;
+            for (size_t j = 0; j < count; ++j)
+            {
+                bytes[pos++] ^= *in++;
+            }
+        }
+    }
+}
+
+// the worst case delta alternates single equal and differing bytes, three bytes of output for every two of input
+constexpr size_t MAX_DELTA = sizeof(Snapshot) * 3 / 2 + 16;
+
+Rewind::Rewind(size_t budget): buffer(budget), deltas(), head(0), current(), scratch(), hasCurrent(false), encoded(MAX_DELTA)
+{
+}
+
+void Rewind::push(const Chip8& chip)
+{
+    // snapshots are value-initialized once and only their fields are written, so padding bytes never differ
+    saveState(chip, scratch);
+    if (!hasCurrent)
+    {
+        copySnapshot(current, scratch);
+        hasCurrent = true;
+        return;
+    }
+
+    size_t length = encodeDelta(scratch, current, encoded.data());
+    if (length > buffer.size())
+    {
+        // cannot be stored at all, the history before this frame is unreachable
+        deltas.clear();
+        head = 0;
+        copySnapshot(current, scratch);
+        return;
+    }
+
+    if (head + length > buffer.size())
+    {
+        // wrap around, everything past head is older than everything before it
+        while (!deltas.empty() && deltas.front().offset >= head)
+        {
+            deltas.pop_front();
+        }
+        head = 0;
+    }
+    while (!deltas.empty() && deltas.front().offset >= head && deltas.front().offset < head + length)
+    {
+        deltas.pop_front();
+    }
+
+    std::memcpy(&buffer[head], encoded.data(), length);
+    deltas.push_back(Delta{ head, length });
+    head += length;
+    copySnapshot(current, scratch);
+}
+
+bool Rewind::stepBack(Chip8& chip)
+{
+    if (deltas.empty())
+    {
+        return false;
+    }
+
+    Delta delta = deltas.back();
+    deltas.pop_back();
+    applyDelta(current, &buffer[delta.offset], delta.length);
+    head = delta.offset;
+    return restoreState(chip, current);
+}
+
+size_t Rewind::frames() const
+{
+    return deltas.size();
+}
+
+void Rewind::clear()
+{
+    deltas.clear();
+    head = 0;
+    hasCurrent = false;
+}
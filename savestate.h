@@ -0,0 +1,74 @@
+#ifndef CHIP8_SAVESTATE
+#define CHIP8_SAVESTATE
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "chip8.h"
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x53533843; // "C8SS" in a little-endian file
+constexpr uint32_t SNAPSHOT_VERSION = 5;
+
+// Full machine state in a fixed layout, so saving and restoring are straight
+// copies and two snapshots can be diffed byte for byte. Files hold this struct
+// as is, in host byte order. Memory comes last and is zero from memUsed up, so
+// copies and deltas stop there; snapshots have to be value-initialized.
+struct Snapshot {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t screen[PLANE_COUNT][HIRES_HEIGHT][ROW_WORDS];
+    uint8_t planes;
+    uint8_t hires;
+    uint8_t V[16];
+    uint16_t stack[16];
+    uint16_t I;
+    uint8_t DT;
+    uint8_t ST;
+    uint16_t PC;
+    uint8_t SP;
+    uint32_t rngState[4];
+    uint8_t rpl[16];
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE];
+    uint8_t pitch;
+    uint8_t halt;
+    uint32_t memUsed; // Chip8::memUsed
+    uint8_t mem[MEM_SIZE];
+};
+
+void saveState(const Chip8& chip, Snapshot& snapshot);
+// returns false, leaving chip untouched, if the snapshot is from another version
+bool restoreState(Chip8& chip, const Snapshot& snapshot);
+
+// false, after printing why, unless the whole snapshot reached the file
+bool writeSnapshot(const char* filename, const Snapshot& snapshot);
+bool readSnapshot(const char* filename, Snapshot& snapshot);
+
+constexpr size_t DEFAULT_REWIND_BUDGET = 8 * 1024 * 1024; // bytes of deltas kept for rewinding
+
+// Frame history for rewinding. Only the newest state is kept whole; every
+// older one is stored as the run-length coded XOR against the state after it,
+// in a ring of fixed size that drops the oldest frames once it is full.
+struct Rewind {
+    Rewind(size_t budget = DEFAULT_REWIND_BUDGET);
+
+    void push(const Chip8& chip); // call once per frame
+    bool stepBack(Chip8& chip);   // restores the frame before the newest, false once history runs out
+    size_t frames() const;        // how many times stepBack can succeed
+    void clear();
+
+    struct Delta {
+        size_t offset;
+        size_t length;
+    };
+
+    std::vector<uint8_t> buffer; // ring of encoded deltas
+    std::deque<Delta> deltas;    // oldest first
+    size_t head;                 // where the next delta is written
+    Snapshot current;            // the newest state pushed
+    Snapshot scratch;            // the state being pushed
+    bool hasCurrent;
+    std::vector<uint8_t> encoded; // staging for one delta, sized for the worst case
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include "chip8.h"
+#include "romlibrary.h"
+#include "savestate.h"
+#include "stepper.h"
+
+using std::printf; using std::exit;
+
+const char* const DEFAULT_REGION = "/chip8";
+
+volatile std::sig_atomic_t stopServing = 0;
+
+void stopHandler(int)
+{
+    stopServing = 1;
+}
+
+// -R: the reward is how much the byte at addr went up since the last step, wrapping like an 8 bit counter
+struct ScoreByte {
+    uint16_t addr;
+    uint8_t last;
+};
+
+int64_t scoreReward(const Chip8& chip, void* user)
+{
+    ScoreByte& score = *static_cast<ScoreByte*>(user);
+    uint8_t value = chip.mem[score.addr];
+    int64_t gained = (int8_t)(value - score.last);
+    score.last = value;
+    return gained;
+}
+
+void usage()
+{
+    printf("usage: chip8-serve <rom> [-n region] [-p cycles-per-frame] [-q modern|vip|chip48|schip|xochip] [-s seed] [-R score-address] [-l rom-library] [-f]\n");
+    printf("       publishes observations in POSIX shared memory, %s by default, for an agent driving it through chip8shm.h\n", DEFAULT_REGION);
+    printf("       -R rewards every step with the change in the byte at score-address\n");
+    printf("       -f replaces a region of the same name, one left by a server that was killed, rather than refusing to start\n");
+    exit(1);
+}
+
+// Serves a ROM to an agent in another process: it steps the program when
+// the agent asks and publishes each result in shared memory, until the
+// agent sends CHIP8_SHM_QUIT or the server is interrupted.
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+
+    const char* romFile = argv[1];
+    const char* region = DEFAULT_REGION;
+    const char* libraryDir = nullptr;
+    int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    uint64_t seed = DEFAULT_SEED;
+    QuirkProfile quirks = QUIRKS_MODERN;
+    bool cyclesPerFrameSet = false;
+    bool quirksSet = false;
+    bool scored = false;
+    bool replace = false;
+    ScoreByte score = { 0, 0 };
+
+    for (auto i = 2; i < argc; ++i)
+    {
+        if (!std::strcmp(argv[i], "-f"))
+        {
+            replace = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage();
+        }
+        if (!std::strcmp(argv[i], "-n"))
+        {
+            region = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "-p"))
+        {
+            cyclesPerFrame = std::atoi(argv[++i]);
+            cyclesPerFrameSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-q"))
+        {
+            if (!parseQuirkProfile(argv[++i], quirks))
+            {
+                usage();
+            }
+            quirksSet = true;
+        }
+        else if (!std::strcmp(argv[i], "-s"))
+        {
+            seed = std::strtoull(argv[++i], nullptr, 0);
+        }
+        else if (!std::strcmp(argv[i], "-R"))
+        {
+            // the whole argument has to be an address, anything else would quietly score address 0
+            char* end;
+            unsigned long addr = std::strtoul(argv[++i], &end, 0);
+            if (end == argv[i] || *end || addr > ADDRESS_MASK)
+            {
+                usage();
+            }
+            score.addr = addr;
+            scored = true;
+        }
+        else if (!std::strcmp(argv[i], "-l"))
+        {
+            libraryDir = argv[++i];
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    // with a library the ROM is a file name or hash in it, and its index entry fills in -p and -q
+    RomLibrary library;
+    const Rom* rom = nullptr;
+    if (libraryDir)
+    {
+        if (!library.open(libraryDir))
+        {
+            exit(1);
+        }
+        rom = library.find(romFile);
+        if (!rom)
+        {
+            printf("%s is not in the ROM library\n", romFile);
+            exit(1);
+        }
+        cyclesPerFrame = cyclesPerFrameSet ? cyclesPerFrame : rom->settings.cyclesPerFrame();
+        quirks = quirksSet ? quirks : rom->settings.quirks;
+    }
+    if (cyclesPerFrame <= 0)
+    {
+        usage();
+    }
+
+    std::unique_ptr<Chip8> chip(new Chip8());
+    if (rom ? !chip->loadBytes(rom->data, rom->size, quirks) : !chip->loadFile(romFile, quirks))
+    {
+        exit(1);
+    }
+    chip->PC = PROGRAM_ADDRESS;
+    chip->seedRandom(seed);
+
+    // resets go back to the state right after loading
+    std::unique_ptr<Snapshot> initial(new Snapshot());
+    saveState(*chip, *initial);
+
+    Stepper stepper(*chip, cyclesPerFrame);
+    if (scored)
+    {
+        score.last = chip->mem[score.addr];
+        stepper.reward = scoreReward;
+        stepper.rewardUser = &score;
+    }
+    if (!stepper.open(region, replace))
+    {
+        exit(1);
+    }
+
+    // the destructor removes the region, so an interrupt has to end the loop rather than the process
+    std::signal(SIGINT, stopHandler);
+    std::signal(SIGTERM, stopHandler);
+
+    printf("serving %s in %s\n", romFile, region);
+    std::fflush(stdout);
+    stepper.serve(*initial, &stopServing);
+    printf("answered %llu requests, %llu instructions since the last reset\n", (unsigned long long)stepper.answered,
+        (unsigned long long)(chip->cycleCount - stepper.startCycles));
+    return 0;
+}
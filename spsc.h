@@ -0,0 +1,53 @@
+#ifndef CHIP8_SPSC
+#define CHIP8_SPSC
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed-size ring shared by exactly one producer thread and one consumer
+// thread. Neither side ever blocks or takes a lock, so it is safe to use from
+// an audio callback. N must be a power of two.
+template <typename T, size_t N>
+struct SpscQueue {
+    static_assert(N && !(N & (N - 1)), "SpscQueue size must be a power of two");
+
+    SpscQueue(): head(0), tail(0)
+    {
+    }
+
+    // producer side, false when full
+    bool push(const T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+        {
+            return false;
+        }
+        items[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, null when empty; the item stays valid until pop
+    const T* front()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &items[h & (N - 1)];
+    }
+
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    T items[N];
+    // kept on separate cache lines so the two threads do not fight over them
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "stepper.h"
+
+static_assert(sizeof(Chip8Observation::screen) == sizeof(Chip8::screen), "observations carry the screen as Chip8 keeps it");
+static_assert(sizeof(Chip8Observation::stack) == sizeof(Chip8::stack) && sizeof(Chip8Observation::V) == sizeof(Chip8::V), "register files differ");
+
+Stepper::Stepper(Chip8& chip, int cyclesPerFrame): chip(chip), cyclesPerFrame(cyclesPerFrame), reward(nullptr), rewardUser(nullptr),
+    shared(nullptr), local(), observation(&local), keypad(0), keyUp(0), frame(0), startCycles(chip.cycleCount), answered(0)
+{
+}
+
+Stepper::~Stepper()
+{
+    if (shared)
+    {
+        munmap(shared, sizeof(Chip8Shm));
+        shm_unlink(name.c_str());
+    }
+}
+
+bool Stepper::open(const char* regionName, bool replace)
+{
+    // another server may still be publishing into a region of the same name, so one is only removed when asked
+    if (replace && shm_unlink(regionName) == 0)
+    {
+        printf("Removed the existing shared memory %s\n", regionName);
+    }
+    int fd = shm_open(regionName, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        if (errno == EEXIST)
+        {
+            printf("Shared memory %s already exists, another server may be using it\n", regionName);
+        }
+        else
+        {
+            printf("Could not create shared memory %s\n", regionName);
+        }
+        return false;
+    }
+    if (ftruncate(fd, sizeof(Chip8Shm)))
+    {
+        printf("Could not size shared memory %s\n", regionName);
+        close(fd);
+        shm_unlink(regionName);
+        return false;
+    }
+    void* mapped = mmap(nullptr, sizeof(Chip8Shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        printf("Could not map shared memory %s\n", regionName);
+        shm_unlink(regionName);
+        return false;
+    }
+
+    shared = static_cast<Chip8Shm*>(mapped);
+    name = regionName;
+    shared->version = CHIP8_SHM_VERSION;
+    shared->size = sizeof(Chip8Shm);
+    shared->cyclesPerFrame = cyclesPerFrame;
+    observation = &shared->observation;
+    publish(0);
+
+    // agents wait for the magic before they trust anything else in the region
+    __atomic_store_n(&shared->magic, CHIP8_SHM_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+const Chip8Observation& Stepper::step(uint16_t held, int frames)
+{
+    // keys held last step but not this one count as released for Fx0A
+    keyUp |= keypad & ~held;
+    keypad = held;
+    for (auto i = 0; i < frames; ++i)
+    {
+        chip.runFrame(cyclesPerFrame, keypad, keyUp);
+    }
+    frame += frames;
+    publish(reward ? reward(chip, rewardUser) : 0);
+    return *observation;
+}
+
+bool Stepper::reset(const Snapshot& state)
+{
+    if (!restoreState(chip, state))
+    {
+        return false;
+    }
+    keypad = 0;
+    keyUp = 0;
+    frame = 0;
+    startCycles = chip.cycleCount;
+    // the hook still runs so one that scores changes can take its baseline, but a reset earns nothing
+    if (reward)
+    {
+        reward(chip, rewardUser);
+    }
+    publish(0);
+    return true;
+}
+
+// Writes the chip's state into the observation under the seqlock. Readers
+// copy while this runs, so the sequence goes odd before the first byte
+// changes and even again only once the last one has.
+void Stepper::publish(int64_t value)
+{
+    uint64_t sequence = 0;
+    if (shared)
+    {
+        sequence = shared->sequence;
+        __atomic_store_n(&shared->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    Chip8Observation& o = *observation;
+    o.step = answered;
+    o.frame = frame;
+    o.cycles = chip.cycleCount - startCycles;
+    o.reward = value;
+    std::memcpy(o.screen, chip.screen, sizeof(o.screen));
+    std::memcpy(o.stack, chip.stack, sizeof(o.stack));
+    o.I = chip.I;
+    o.PC = chip.PC;
+    o.keypad = keypad;
+    std::memcpy(o.V, chip.V, sizeof(o.V));
+    o.DT = chip.DT;
+    o.ST = chip.ST;
+    o.SP = chip.SP;
+    o.hires = chip.hires;
+    o.planes = chip.planes;
+    o.halt = chip.halt;
+
+    if (shared)
+    {
+        __atomic_store_n(&shared->sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+}
+
+bool Stepper::serve(const Snapshot& initial, const volatile std::sig_atomic_t* stop)
+{
+    if (!shared)
+    {
+        return false;
+    }
+
+    int idle = 0;
+    while (!(stop && *stop))
+    {
+        uint64_t request = __atomic_load_n(&shared->request, __ATOMIC_ACQUIRE);
+        if (request == answered)
+        {
+            // an agent that is stepping asks again within microseconds, one that is thinking can wait for a time slice
+            if (idle >= SERVE_SPINS * 16)
+            {
+                usleep(SERVE_NAP_US);
+            }
+            else if (++idle > SERVE_SPINS)
+            {
+                sched_yield();
+            }
+            continue;
+        }
+        idle = 0;
+
+        // the request is answered with whatever it asked, even if the agent skipped numbers
+        answered = request;
+        uint32_t command = shared->requestCommand;
+        if (command == CHIP8_SHM_STEP)
+        {
+            step(shared->requestKeypad, shared->requestFrames);
+        }
+        else if (command == CHIP8_SHM_RESET)
+        {
+            reset(initial);
+        }
+        else if (command == CHIP8_SHM_QUIT)
+        {
+            publish(0);
+            break;
+        }
+        else
+        {
+            printf("Ignored unknown request %u\n", command);
+            publish(0);
+        }
+    }
+    return true;
+}
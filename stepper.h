@@ -0,0 +1,52 @@
+#ifndef CHIP8_STEPPER
+#define CHIP8_STEPPER
+
+#include <csignal>
+#include <cstdint>
+#include <string>
+#include "chip8.h"
+#include "chip8shm.h"
+#include "savestate.h"
+
+constexpr int SERVE_SPINS = 64; // empty polls before a waiting server starts yielding its core
+constexpr int SERVE_NAP_US = 200; // how long it sleeps between polls once the agent has been quiet for a while
+
+// scores a step from the state it left, e.g. the change in a score kept in memory
+typedef int64_t (*RewardFn)(const Chip8& chip, void* user);
+
+// Runs a Chip8 in steps of whole frames for an agent and publishes every
+// result as a Chip8Observation, into a shared memory region once open
+// succeeds so another process can read it in place, or into a member of its
+// own until then.
+struct Stepper {
+    Stepper(Chip8& chip, int cyclesPerFrame);
+    ~Stepper(); // unmaps and removes the region
+
+    Chip8& chip;
+    int cyclesPerFrame;
+    RewardFn reward;   // called after every step when set
+    void* rewardUser;  // passed to reward
+    Chip8Shm* shared;  // nullptr until open succeeds
+    std::string name;  // of the region, for removing it
+    Chip8Observation local;
+    Chip8Observation* observation; // where steps are published, in shared or local
+    uint16_t keypad;   // held during the last step
+    uint16_t keyUp;    // released since the last Fx0A
+    uint64_t frame;
+    uint64_t startCycles; // chip.cycleCount at the start or the last reset
+    uint64_t answered;    // the last request served
+
+    // creates the region, name being a POSIX shared memory name like /chip8, and publishes the current state;
+    // fails if the name is taken unless replace, which first removes what is there, e.g. after a server was killed
+    bool open(const char* name, bool replace = false);
+    // runs frames frames with keypad held (bit n = key n) and publishes the state they leave
+    const Chip8Observation& step(uint16_t keypad, int frames);
+    // puts the chip back in state and publishes it as frame 0
+    bool reset(const Snapshot& state);
+    // answers requests from the region until one asks to quit or stop is set, false if the region is not open
+    bool serve(const Snapshot& initial, const volatile std::sig_atomic_t* stop);
+
+    void publish(int64_t value);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "trace.h"
+
+TraceRing::TraceRing(): records{}, head(0)
+{
+}
+
+bool TraceRing::dump(const char* filename) const
+{
+    FILE* file = std::fopen(filename, "wb");
+    if (!file)
+    {
+        printf("Could not open trace file %s\n", filename);
+        return false;
+    }
+
+    uint64_t total = head.load(std::memory_order_acquire);
+    uint64_t count = total < TRACE_CAPACITY ? total : TRACE_CAPACITY;
+    TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, total, (uint32_t)count, 0 };
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    // oldest record first, the ring may wrap once
+    size_t start = (total - count) & (TRACE_CAPACITY - 1);
+    size_t firstPart = count < TRACE_CAPACITY - start ? count : TRACE_CAPACITY - start;
+    std::fwrite(&records[start], sizeof(TraceRecord), firstPart, file);
+    std::fwrite(&records[0], sizeof(TraceRecord), count - firstPart, file);
+
+    std::fclose(file);
+    return true;
+}
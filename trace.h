@@ -0,0 +1,49 @@
+#ifndef CHIP8_TRACE_RING
+#define CHIP8_TRACE_RING
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+// Binary instruction trace. Chip8 only records into a TraceRing when built
+// with CHIP8_TRACE defined (make TRACE=1); otherwise the hook compiles to nothing.
+// Instructions run inside JIT blocks are not recorded.
+
+constexpr uint32_t TRACE_MAGIC = 0x52543843; // "C8TR" in a little-endian file
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr size_t TRACE_CAPACITY = 1 << 16; // records kept, must be a power of two
+
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t opcode;
+};
+
+// dump file layout, all fields little-endian
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t total;  // records ever pushed, the first (total - count) were overwritten
+    uint32_t count;  // records that follow the header, oldest first
+    uint32_t reserved;
+};
+
+// Fixed-size ring holding the most recent TRACE_CAPACITY instructions.
+// Only the emulation thread pushes; any thread may dump, and sees every record
+// published before the head it loads.
+struct TraceRing {
+    TraceRing();
+
+    TraceRecord records[TRACE_CAPACITY];
+    std::atomic<uint64_t> head; // records pushed so far
+
+    void push(uint16_t pc, uint16_t opcode)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        records[h & (TRACE_CAPACITY - 1)] = TraceRecord{pc, opcode};
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    bool dump(const char* filename) const;
+};
+
+#endif
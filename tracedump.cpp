@@ -0,0 +1,50 @@
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include "trace.h"
+
+using std::printf; using std::exit;
+
+// Decodes a binary trace written by TraceRing::dump into one text line per instruction.
+int main(int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        printf("usage: chip8-tracedump <trace>\n");
+        exit(1);
+    }
+
+    FILE* file = std::fopen(argv[1], "rb");
+    if (!file)
+    {
+        printf("File not found\n");
+        exit(1);
+    }
+
+    TraceHeader header;
+    if (std::fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC)
+    {
+        printf("Not a chip8 trace\n");
+        exit(1);
+    }
+    if (header.version != TRACE_VERSION)
+    {
+        printf("Unsupported trace version %u\n", header.version);
+        exit(1);
+    }
+
+    std::vector<TraceRecord> records(header.count);
+    size_t count = std::fread(records.data(), sizeof(TraceRecord), header.count, file);
+    std::fclose(file);
+
+    // number instructions from the start of the run, not from the start of the ring
+    uint64_t first = header.total - header.count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        printf("%llu op %04hX ad %04hX\n", (unsigned long long)(first + i), records[i].opcode, records[i].pc);
+    }
+    if (count < header.count)
+    {
+        printf("trace truncated after %zu of %u records\n", count, header.count);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef CHIP8_TRIPLEBUFFER
+#define CHIP8_TRIPLEBUFFER
+
+#include <atomic>
+#include <cstdint>
+
+// Hands whole values from one producer thread to one consumer thread without
+// locks or waiting. The producer always has a slot of its own to fill and the
+// consumer always has one to read; the third holds the newest published value,
+// so the consumer only ever sees the latest complete one and a slow consumer
+// never holds up the producer.
+template <typename T>
+struct TripleBuffer {
+    TripleBuffer(): back(0), middle(1), front(2)
+    {
+    }
+
+    // producer: fill this, then publish
+    T& writeSlot()
+    {
+        return slots[back];
+    }
+
+    // false if the value it replaces was never taken, i.e. the consumer skipped it
+    bool publish()
+    {
+        uint8_t replaced = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = replaced & INDEX;
+        return !(replaced & FRESH);
+    }
+
+    // consumer: true and the newest value moved to readSlot if anything was published since the last call
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& readSlot() const
+    {
+        return slots[front];
+    }
+
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4; // set on middle while it holds a value the consumer has not taken
+
+    T slots[3];
+    uint8_t back; // producer's slot
+    alignas(64) std::atomic<uint8_t> middle;
+    alignas(64) uint8_t front; // consumer's slot
+};
+
+#endif